@@ -0,0 +1,296 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* forecast-bench: measures the stages of a forecast invocation one by
+ * one against recorded API responses. Output is one tab separated line
+ * per stage and fixture:
+ *
+ *   stage fixture iterations ns/op allocs/op bytes/op
+ *
+ * Allocations are counted by interposing malloc() and friends, which
+ * catches those made inside json-c, libconfig and curses as well. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libforecast.h"
+
+#define BENCH_MIN_NS 200000000ULL
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+extern void  __libc_free(void*);
+
+static struct {
+  uint64_t allocs;
+  uint64_t bytes;
+} counters;
+
+void* malloc(size_t n) {
+  counters.allocs++;
+  counters.bytes += n;
+  return __libc_malloc(n);
+}
+
+void* calloc(size_t n, size_t m) {
+  counters.allocs++;
+  counters.bytes += n * m;
+  return __libc_calloc(n, m);
+}
+
+void* realloc(void *p, size_t n) {
+  counters.allocs++;
+  counters.bytes += n;
+  return __libc_realloc(p, n);
+}
+
+void free(void *p) {
+  __libc_free(p);
+}
+
+typedef struct {
+  const char *name;
+  Config config;
+  Location location;
+  Data data;
+  struct json_object *json;
+  Forecast forecast;
+  const Datablock *series;
+  FILE *sink;
+} Fixture;
+
+typedef struct {
+  const char *name;
+  int needs;          /* BLOCK_* flags of the blocks the stage uses */
+  int (*run)(Fixture*);
+} Stage;
+
+static uint64_t now_ns(void);
+static int      bench_load_config(Fixture*);
+static int      bench_load_cache(Fixture*);
+static int      bench_json_parse(Fixture*);
+static int      bench_extract(Fixture*);
+static int      bench_render_datapoint(Fixture*);
+static int      bench_barplot_scale(Fixture*);
+static int      bench_barplot2(Fixture*);
+static int      bench_minutely(Fixture*);
+static void     bench(const Stage*, Fixture*);
+static int      fixture_open(Fixture*, const char *config, const char *path);
+static void     fixture_close(Fixture*);
+
+static const Stage stages[] = {
+  { "load_config",        0,              bench_load_config       },
+  { "load_cache",         0,              bench_load_cache        },
+  { "json_tokener_parse", 0,              bench_json_parse        },
+  { "extract",            0,              bench_extract           },
+  { "render_datapoint",   0,              bench_render_datapoint  },
+  { "barplot_scale",      BLOCK_HOURLY,   bench_barplot_scale     },
+  { "barplot2",           BLOCK_HOURLY,   bench_barplot2          },
+  { "minutely",           BLOCK_MINUTELY, bench_minutely          }
+};
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int bench_load_config(Fixture *fx) {
+  Config c = CONFIG_NULL;
+  int ret;
+
+  c.path = fx->config.path;
+  ret = load_config(&c);
+  free_config(&c);
+
+  return ret;
+}
+
+int bench_load_cache(Fixture *fx) {
+  Data d = DATA_NULL;
+  int ret = load_cache(&fx->location, &d);
+  free_data(&d);
+  return ret;
+}
+
+int bench_json_parse(Fixture *fx) {
+  struct json_object *o = json_tokener_parse(fx->data.data);
+  if(o == NULL)
+    return -1;
+  json_object_put(o);
+  return 0;
+}
+
+int bench_extract(Fixture *fx) {
+  Forecast f = FORECAST_NULL;
+  int ret = extract_forecast(fx->json, &f);
+  free_forecast(&f);
+  return ret;
+}
+
+/* One op renders the whole hourly block, or the current conditions if
+ * there is none */
+int bench_render_datapoint(Fixture *fx) {
+  if(fx->series == NULL)
+    return render_datapoint(fx->sink, &fx->forecast.currently);
+  for(int i = 0; i < fx->series->len; i++)
+    render_datapoint(fx->sink, &fx->series->data[i]);
+  return 0;
+}
+
+/* Three series, as plot-hourly with all of its temperature fields */
+int bench_barplot_scale(Fixture *fx) {
+  const int len = fx->series->len;
+  double t[len], at[len], dp[len];
+  int scaled[3*len];
+  double dmax, dmin;
+  const PlotOverlay o = {
+    .n = 3,
+    .len = len,
+    .values = { t, at, dp }
+  };
+
+  for(int i = 0; i < len; i++) {
+    t[i] = render_f2c(fx->series->data[i].temperature);
+    at[i] = render_f2c(fx->series->data[i].apparentTemperature);
+    dp[i] = render_f2c(fx->series->data[i].dewPoint);
+  }
+  barplot_scale(&o, fx->config.plot.height, scaled, &dmax, &dmin);
+
+  return 0;
+}
+
+int bench_barplot2(Fixture *fx) {
+  return render_hourly_datapoints_plot(&fx->config.plot, fx->series, fx->forecast.offset);
+}
+
+/* Downsampling and drawing, what a refresh every minute costs */
+int bench_minutely(Fixture *fx) {
+  return render_precipitation_plot_minutely(&fx->config.plot, &fx->forecast.minutely,
+      fx->forecast.offset);
+}
+
+void bench(const Stage *s, Fixture *fx) {
+  uint64_t iterations = 1;
+  uint64_t elapsed;
+  uint64_t allocs, bytes;
+
+  if((fx->forecast.blocks & s->needs) != s->needs)
+    return;
+
+  /* Grow the number of iterations until the stage ran long enough to
+   * give a stable per-op time */
+  for(;;) {
+    uint64_t start;
+
+    counters.allocs = counters.bytes = 0;
+    start = now_ns();
+    for(uint64_t i = 0; i < iterations; i++)
+      if(s->run(fx) != 0) {
+        fprintf(stderr, "%s/%s: %s\n", s->name, fx->name, forecast_strerror());
+        return;
+      }
+    elapsed = now_ns() - start;
+    allocs = counters.allocs;
+    bytes = counters.bytes;
+
+    if(elapsed >= BENCH_MIN_NS || iterations >= (1ULL << 30))
+      break;
+    iterations *= elapsed > 0 && BENCH_MIN_NS / elapsed < 10 ? 2 : 10;
+  }
+
+  printf("%s\t%s\t%llu\t%.1f\t%.1f\t%.1f\n",
+      s->name, fx->name,
+      (unsigned long long) iterations,
+      (double) elapsed / iterations,
+      (double) allocs / iterations,
+      (double) bytes / iterations);
+}
+
+int fixture_open(Fixture *fx, const char *config, const char *path) {
+  const char *slash = strrchr(path, '/');
+
+  fx->name = slash ? slash + 1 : path;
+  fx->config = (Config) CONFIG_NULL;
+  fx->location = (Location) LOCATION_NULL;
+  fx->data = (Data) DATA_NULL;
+  fx->forecast = (Forecast) FORECAST_NULL;
+  fx->series = NULL;
+
+  fx->config.path = (char*) config;
+  if(load_config(&fx->config) != 0)
+    return -1;
+
+  /* Every fixture is a cache file that never expires */
+  fx->location.cache_file = (char*) path;
+  fx->location.max_cache_age = 0x7fffffff;
+
+  if(load_cache(&fx->location, &fx->data) != 0
+      || codec_decompress(&fx->data) != 0
+      || (fx->json = json_tokener_parse(fx->data.data)) == NULL
+      || extract_forecast(fx->json, &fx->forecast) != 0)
+    return -1;
+
+  if(fx->forecast.blocks & BLOCK_HOURLY)
+    fx->series = &fx->forecast.hourly;
+
+  if((fx->sink = fopen("/dev/null", "r+")) == NULL)
+    return -1;
+
+  return 0;
+}
+
+void fixture_close(Fixture *fx) {
+  fclose(fx->sink);
+  json_object_put(fx->json);
+  free_forecast(&fx->forecast);
+  free_data(&fx->data);
+  free_config(&fx->config);
+}
+
+int main(int argc, char **argv) {
+  if(argc < 3) {
+    fputs("Usage: forecast-bench CONFIG FIXTURE...\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  printf("stage\tfixture\titerations\tns/op\tallocs/op\tbytes/op\n");
+
+  for(int i = 2; i < argc; i++) {
+    Fixture fx;
+
+    if(fixture_open(&fx, argv[1], argv[i]) != 0)
+      LERROR(EXIT_FAILURE, 0, "%s: %s", argv[i], forecast_strerror());
+
+    barplot_headless(fx.sink);
+    for(int j = 0; j < sizeof(stages)/sizeof(stages[0]); j++)
+      /* load_config doesn't depend on the fixture */
+      if(j > 0 || i == 2)
+        bench(&stages[j], &fx);
+
+    fixture_close(&fx);
+  }
+
+  forecast_cleanup();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,317 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* forecast-mockserver: answers every GET request with one of the given
+ * API responses, so the network, cache and batch paths can be measured
+ * without a network or an API key. Point api_url at it:
+ *
+ *   api_url = "http://127.0.0.1:8080/forecast";
+ *
+ * Latency, jitter, the share of failing requests and the payload size
+ * are configurable. The fixtures are served in turn. */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "forecast.h"
+
+#define MOCK_REQUEST_MAX 8192
+
+typedef struct {
+  char *data;
+  size_t len;
+} Payload;
+
+typedef struct {
+  int fd;
+  unsigned int seed;
+} Connection;
+
+static struct {
+  Payload *payloads;
+  int payloads_len;
+  int latency;        /* ms */
+  int jitter;         /* ms, uniformly distributed around latency */
+  double error_rate;  /* 0.0 to 1.0 */
+  size_t size;        /* minimum payload size, 0 to serve them as is */
+} mock = {
+  .payloads = NULL,
+  .payloads_len = 0,
+  .latency = 0,
+  .jitter = 0,
+  .error_rate = 0.0,
+  .size = 0
+};
+
+static volatile sig_atomic_t stop = 0;
+static uint64_t served = 0;
+static uint64_t failed = 0;
+
+static void   load_payload(const char *path, Payload *p);
+static void   on_signal(int sig);
+static void*  serve(void *arg);
+static void   usage(void);
+static void   write_all(int fd, const char *buf, size_t len);
+
+/* Pads the response to mock.size bytes with a member the client ignores */
+void load_payload(const char *path, Payload *p) {
+  static const char pad_open[] = "\"padding\":\"";
+  static const char pad_close[] = "\",";
+  const size_t pad_min = sizeof(pad_open) - 1 + sizeof(pad_close) - 1;
+  FILE *fp;
+  char *buf, *brace;
+  long len;
+
+  if((fp = fopen(path, "r")) == NULL
+      || fseek(fp, 0, SEEK_END) != 0
+      || (len = ftell(fp)) < 0
+      || fseek(fp, 0, SEEK_SET) != 0)
+    LERROR(EXIT_FAILURE, errno, "%s", path);
+
+  if((buf = malloc(len + 1)) == NULL)
+    LERROR(EXIT_FAILURE, errno, "malloc()");
+  if(fread(buf, 1, len, fp) != len)
+    LERROR(EXIT_FAILURE, errno, "%s", path);
+  fclose(fp);
+  buf[len] = '\0';
+
+  p->data = buf;
+  p->len = len;
+
+  if(mock.size <= len + pad_min)
+    return;
+
+  if((brace = strchr(buf, '{')) == NULL)
+    LERROR(EXIT_FAILURE, 0, "%s: not a JSON object", path);
+
+  const size_t at = brace - buf + 1;
+  const size_t pad = mock.size - len - pad_min;
+  char *w;
+
+  p->len = mock.size;
+  if((p->data = w = malloc(p->len + 1)) == NULL)
+    LERROR(EXIT_FAILURE, errno, "malloc()");
+
+  memcpy(w, buf, at);
+  w += at;
+  memcpy(w, pad_open, sizeof(pad_open) - 1);
+  w += sizeof(pad_open) - 1;
+  memset(w, 'x', pad);
+  w += pad;
+  memcpy(w, pad_close, sizeof(pad_close) - 1);
+  w += sizeof(pad_close) - 1;
+  memcpy(w, buf + at, len - at);
+  p->data[p->len] = '\0';
+
+  free(buf);
+}
+
+void on_signal(int sig) {
+  stop = 1;
+}
+
+void write_all(int fd, const char *buf, size_t len) {
+  while(len > 0) {
+    ssize_t w = write(fd, buf, len);
+    if(w <= 0)
+      return;
+    buf += w;
+    len -= w;
+  }
+}
+
+void* serve(void *arg) {
+  Connection *conn = (Connection*) arg;
+  char req[MOCK_REQUEST_MAX];
+  char header[256];
+  size_t reqlen = 0;
+  ssize_t r;
+  int delay;
+
+  /* Only the request line matters, the rest is read and dropped. A
+   * peer closing before sending anything leaves an empty request. */
+  req[0] = '\0';
+  while(reqlen < sizeof(req) - 1
+      && (r = read(conn->fd, req + reqlen, sizeof(req) - 1 - reqlen)) > 0) {
+    reqlen += r;
+    req[reqlen] = '\0';
+    if(strstr(req, "\r\n\r\n") != NULL)
+      break;
+  }
+
+  delay = mock.latency;
+  if(mock.jitter > 0)
+    delay += rand_r(&conn->seed) % (2 * mock.jitter + 1) - mock.jitter;
+  if(delay > 0)
+    nanosleep(&(struct timespec) {
+        .tv_sec = delay / 1000,
+        .tv_nsec = (delay % 1000) * 1000000L }, NULL);
+
+  if(strncmp(req, "GET ", 4) != 0) {
+    static const char body[] = "{\"code\":405,\"error\":\"method not allowed\"}";
+    int hlen = snprintf(header, sizeof(header),
+        "HTTP/1.1 405 Method Not Allowed\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n", sizeof(body) - 1);
+    write_all(conn->fd, header, hlen);
+    write_all(conn->fd, body, sizeof(body) - 1);
+    __sync_fetch_and_add(&failed, 1);
+  } else if((double) rand_r(&conn->seed) / RAND_MAX < mock.error_rate) {
+    static const char body[] = "{\"code\":503,\"error\":\"mock failure\"}";
+    int hlen = snprintf(header, sizeof(header),
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n", sizeof(body) - 1);
+    write_all(conn->fd, header, hlen);
+    write_all(conn->fd, body, sizeof(body) - 1);
+    __sync_fetch_and_add(&failed, 1);
+  } else {
+    const Payload *p = &mock.payloads[__sync_fetch_and_add(&served, 1) % mock.payloads_len];
+    int hlen = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n", p->len);
+    write_all(conn->fd, header, hlen);
+    write_all(conn->fd, p->data, p->len);
+  }
+
+  close(conn->fd);
+  free(conn);
+
+  return NULL;
+}
+
+void usage(void) {
+  puts("Usage:\n"
+       "  forecast-mockserver [OPTIONS] FIXTURE...\n"
+       "Options:\n"
+       "  -a ADDRESS   IPv4 address to listen on. Defaults to 127.0.0.1\n"
+       "  -p PORT      Port to listen on. Defaults to 8080\n"
+       "  -l MS        Delay every response by this many milliseconds\n"
+       "  -j MS        Vary the delay by up to this many milliseconds either way\n"
+       "  -e RATE      Fail this fraction of the requests with 503, e.g. 0.05\n"
+       "  -s BYTES     Pad the responses to at least this size\n"
+       "  -h           Print this message and exit\n"
+       "The served and failed request counts are printed on SIGINT or SIGTERM.");
+}
+
+int main(int argc, char **argv) {
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(8080),
+    .sin_addr = { htonl(INADDR_LOOPBACK) }
+  };
+  struct sigaction sa = { .sa_handler = on_signal };
+  pthread_attr_t attr;
+  unsigned int seed = time(NULL);
+  int opt, fd, one = 1;
+
+  while((opt = getopt(argc, argv, "a:e:hj:l:p:s:")) != -1) {
+    switch(opt) {
+      case 'a':
+        if(inet_pton(AF_INET, optarg, &addr.sin_addr) != 1)
+          LERROR(EXIT_FAILURE, 0, "-a: not an IPv4 address: %s", optarg);
+        break;
+      case 'e':
+        mock.error_rate = atof(optarg);
+        break;
+      case 'j':
+        mock.jitter = atoi(optarg);
+        break;
+      case 'l':
+        mock.latency = atoi(optarg);
+        break;
+      case 'p':
+        addr.sin_port = htons(atoi(optarg));
+        break;
+      case 's':
+        mock.size = strtoul(optarg, NULL, 10);
+        break;
+      case 'h':
+        usage();
+        return EXIT_SUCCESS;
+      default:
+        usage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  if(optind == argc) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  mock.payloads_len = argc - optind;
+  if((mock.payloads = calloc(mock.payloads_len, sizeof(Payload))) == NULL)
+    LERROR(EXIT_FAILURE, errno, "calloc()");
+  for(int i = 0; i < mock.payloads_len; i++)
+    load_payload(argv[optind + i], &mock.payloads[i]);
+
+  if((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    LERROR(EXIT_FAILURE, errno, "socket()");
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 128) != 0)
+    LERROR(EXIT_FAILURE, errno, "bind()");
+
+  /* Without SA_RESTART, so that accept() returns */
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while(stop == 0) {
+    Connection *conn;
+    pthread_t tid;
+    int cfd;
+
+    if((cfd = accept(fd, NULL, NULL)) == -1)
+      continue;
+
+    if((conn = malloc(sizeof(Connection))) == NULL)
+      LERROR(EXIT_FAILURE, errno, "malloc()");
+    conn->fd = cfd;
+    conn->seed = rand_r(&seed);
+    if(pthread_create(&tid, &attr, serve, conn) != 0) {
+      close(cfd);
+      free(conn);
+    }
+  }
+
+  close(fd);
+  fprintf(stderr, "served\t%llu\nfailed\t%llu\n",
+      (unsigned long long) served, (unsigned long long) failed);
+
+  return EXIT_SUCCESS;
+}
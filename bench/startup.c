@@ -0,0 +1,134 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* forecast-startup: measures what an invocation of forecast costs from
+ * exec to exit, by running the given command line over and over with
+ * its output going to /dev/null. On the cache hit path, that is mostly
+ * the dynamic linker and library initialization. Output is one tab
+ * separated line:
+ *
+ *   command runs ns/op min-ns minflt/op
+ *
+ * minflt/op is the number of minor page faults per run, which grows
+ * with every shared library that is mapped and relocated. */
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "forecast.h"
+
+#define STARTUP_RUNS 200
+
+static uint64_t now_ns(void);
+static void     usage(void);
+
+uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void usage(void) {
+  puts("Usage:\n"
+       "  forecast-startup [-n RUNS] PROGRAM [ARGUMENT...]\n"
+       "Options:\n"
+       "  -n RUNS      Number of runs. Defaults to 200\n"
+       "  -h           Print this message and exit");
+}
+
+int main(int argc, char **argv) {
+  uint64_t total = 0, fastest = UINT64_MAX, minflt = 0;
+  char command[256] = "";
+  int opt, runs = STARTUP_RUNS, devnull;
+
+  /* Options after PROGRAM are its own */
+  while((opt = getopt(argc, argv, "+hn:")) != -1) {
+    switch(opt) {
+      case 'n':
+        if((runs = atoi(optarg)) < 1)
+          LERROR(EXIT_FAILURE, 0, "-n: invalid number of runs: %s", optarg);
+        break;
+      case 'h':
+        usage();
+        return EXIT_SUCCESS;
+      default:
+        usage();
+        return EXIT_FAILURE;
+    }
+  }
+
+  if(optind == argc) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  for(int i = optind; i < argc; i++) {
+    const size_t len = strlen(command);
+    snprintf(&command[len], sizeof(command) - len, "%s%s", i > optind ? " " : "", argv[i]);
+  }
+
+  if((devnull = open("/dev/null", O_RDWR)) == -1)
+    LERROR(EXIT_FAILURE, errno, "/dev/null");
+
+  for(int i = 0; i < runs; i++) {
+    struct rusage ru;
+    uint64_t start, elapsed;
+    pid_t pid;
+    int status;
+
+    start = now_ns();
+    if((pid = fork()) == -1)
+      LERROR(EXIT_FAILURE, errno, "fork()");
+    if(pid == 0) {
+      dup2(devnull, STDOUT_FILENO);
+      dup2(devnull, STDERR_FILENO);
+      execvp(argv[optind], &argv[optind]);
+      _exit(127);
+    }
+    if(wait4(pid, &status, 0, &ru) != pid)
+      LERROR(EXIT_FAILURE, errno, "wait4()");
+    elapsed = now_ns() - start;
+
+    if(WIFEXITED(status) == 0 || WEXITSTATUS(status) != 0)
+      LERROR(EXIT_FAILURE, 0, "%s failed with status %d, run it by hand to see why",
+          command, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+    total += elapsed;
+    minflt += ru.ru_minflt;
+    if(elapsed < fastest)
+      fastest = elapsed;
+  }
+
+  close(devnull);
+
+  printf("command\truns\tns/op\tmin-ns\tminflt/op\n");
+  printf("%s\t%d\t%.1f\t%llu\t%.1f\n", command, runs,
+      (double) total / runs, (unsigned long long) fastest, (double) minflt / runs);
+
+  return EXIT_SUCCESS;
+}
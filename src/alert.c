@@ -0,0 +1,91 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "alert.h"
+#include "parse.h"
+
+static int alert_datablock(const AlertRule *r, const Location *l, const char *block,
+             const Datapoint *data, int len, time_t step, time_t now, FILE *out);
+
+int alert_datablock(const AlertRule *r, const Location *l, const char *block,
+    const Datapoint *data, int len, time_t step, time_t now, FILE *out) {
+  const DatapointField *field = &datapoint_fields[r->field];
+  const bool window = r->within > 0 && step > 0;
+  const time_t from = window ? now - step : 0;
+  const time_t to = window ? now + r->within * step : (time_t) INT64_MAX;
+  int matches = 0;
+
+  for(int i = 0; i < len; i++) {
+    const double v = datapoint_value(&data[i], field);
+    bool match;
+
+    /* The data point covering now is the first one in the window */
+    if(data[i].time <= from || data[i].time >= to)
+      continue;
+
+    /* NAN, a missing value, never matches */
+    switch(r->cmp) {
+      case ALERT_LT: match = v <  r->value; break;
+      case ALERT_LE: match = v <= r->value; break;
+      case ALERT_GT: match = v >  r->value; break;
+      case ALERT_GE: match = v >= r->value; break;
+      case ALERT_EQ: match = v == r->value; break;
+      case ALERT_NE: match = !isnan(v) && v != r->value; break;
+      default:       match = false;
+    }
+
+    if(match) {
+      fprintf(out, "%s\t%s\t%s\t%lld\t%s\t%.15g\n", l->name ?: "", r->name, block,
+          (long long) data[i].time, field->key, v);
+      matches++;
+    }
+  }
+
+  return matches;
+}
+
+int alert_evaluate(const Config *c, const Location *l, const Forecast *f, time_t now,
+    FILE *out) {
+  int matches = 0;
+
+  /* Rules on blocks excluded for this location don't apply */
+  for(int i = 0; i < c->alert_rules_len; i++) {
+    const AlertRule *r = &c->alert_rules[i];
+
+    if((f->blocks & r->block) == 0)
+      continue;
+
+    switch(r->block) {
+      case BLOCK_CURRENTLY:
+        matches += alert_datablock(r, l, "currently", &f->currently, 1, 0, 0, out);
+        break;
+      case BLOCK_HOURLY:
+        matches += alert_datablock(r, l, "hourly", f->hourly.data, f->hourly.len, 3600, now, out);
+        break;
+      case BLOCK_DAILY:
+        matches += alert_datablock(r, l, "daily", f->daily.data, f->daily.len, 86400, now, out);
+        break;
+    }
+  }
+
+  return matches;
+}
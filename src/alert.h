@@ -0,0 +1,35 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALERT_H
+#define ALERT_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "forecast.h"
+
+/* Checks every rule in c->alert_rules against the forecast and writes
+ * one tab separated line of location, rule, block, time, field and
+ * value per matching data point. Rules with a window only look at the
+ * data points covering the next rule->within hours or days after now.
+ * Returns the number of matches. */
+int alert_evaluate(const Config *c, const Location *l, const Forecast *f, time_t now,
+      FILE *out);
+
+#endif
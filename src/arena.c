@@ -0,0 +1,104 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "forecast.h"
+
+void* arena_alloc(Arena *a, size_t size) {
+  const size_t align = sizeof(ArenaAlign);
+  const size_t block_size = a->block_size ? a->block_size : ARENA_BLOCK;
+  ArenaBlock *b = a->head;
+  void *r;
+
+  size = (size + align - 1) / align * align;
+
+  if(b == NULL || b->size - b->used < size) {
+    const size_t bsize = size > block_size ? size : block_size;
+
+    b = malloc(sizeof(ArenaBlock) + bsize);
+    GUARD_ALLOC(b, NULL);
+    b->size = bsize;
+    b->used = 0;
+    /* Oversized requests get a block of their own behind the current
+     * one, which keeps its free space */
+    if(a->head != NULL && size > block_size) {
+      b->next = a->head->next;
+      a->head->next = b;
+    } else {
+      b->next = a->head;
+      a->head = b;
+    }
+  }
+
+  r = (char*) b->data + b->used;
+  b->used += size;
+  memset(r, 0, size);
+
+  return r;
+}
+
+void* arena_calloc(Arena *a, size_t nmemb, size_t size) {
+  if(size != 0 && nmemb > SIZE_MAX / size) {
+    FERROR(ENOMEM, "arena_calloc(%zu, %zu)", nmemb, size);
+    return NULL;
+  }
+  return arena_alloc(a, nmemb * size);
+}
+
+char* arena_strdup(Arena *a, const char *s) {
+  size_t len = strlen(s) + 1;
+  char *r = arena_alloc(a, len);
+
+  if(r != NULL)
+    memcpy(r, s, len);
+  return r;
+}
+
+char* arena_printf(Arena *a, const char *fmt, ...) {
+  va_list ap;
+  int len;
+  char *r;
+
+  va_start(ap, fmt);
+  len = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+
+  if((r = arena_alloc(a, len + 1)) == NULL)
+    return NULL;
+
+  va_start(ap, fmt);
+  vsnprintf(r, len + 1, fmt, ap);
+  va_end(ap);
+
+  return r;
+}
+
+void arena_free(Arena *a) {
+  ArenaBlock *b;
+
+  while((b = a->head) != NULL) {
+    a->head = b->next;
+    free(b);
+  }
+}
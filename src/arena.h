@@ -0,0 +1,60 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK 16384
+
+/* A region of memory handed out by bumping a pointer and released all
+ * at once. Everything a Config or a Forecast points to lives in its
+ * arena, so neither needs to be freed field by field. */
+/* max_align_t is C11 */
+typedef union {
+  long double ld;
+  long long ll;
+  void *p;
+  void (*fp)(void);
+} ArenaAlign;
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size;
+  size_t used;
+  ArenaAlign data[];
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock *head;     /* the block allocated from, newest first */
+  size_t block_size;    /* 0 for ARENA_BLOCK */
+} Arena;
+
+#define ARENA_NULL { .head = NULL, .block_size = 0 }
+
+/* Memory from arena_alloc() is zeroed and suitably aligned for any
+ * type. arena_free() returns everything. */
+void* arena_alloc(Arena *a, size_t size);
+void* arena_calloc(Arena *a, size_t nmemb, size_t size);
+char* arena_strdup(Arena *a, const char *s);
+char* arena_printf(Arena *a, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+void  arena_free(Arena *a);
+
+#endif
@@ -19,50 +19,144 @@
 #include "forecast.h"
 #include "barplot.h"
 
-static void start_curses(const PlotCfg*);
+static int  start_curses(const PlotCfg*);
 static void end_curses(void);
-static void barplot_scale(const double*, size_t, int, int*, double*, double*, double*);
-static void barplot_legend(int dx, int dy, int height, double dmax, double dmin);
-static double frac_of_day_mins(const struct tm *t);
+static void barplot_legend(int dx, int y, int up, int down, double dmax, double dmin);
+static int minute_of_day(time_t t, double offset);
+static time_t local_time(time_t t, double offset);
+static void terminal_size(int *rows, int *cols);
+
+/* When set, plots are drawn to this stream instead of the terminal and
+ * don't wait for a key press */
+static FILE *headless = NULL;
+static SCREEN *headless_screen = NULL;
+
+static struct {
+  PlotSeries *s;
+  bool busy;
+} plot_pool[PLOT_POOL_SIZE];
+
+/* Labels by format and local time. The same hours and days are labelled
+ * by several plot modes and on every redraw, so most labels are
+ * formatted only once. Like the pool, the cache is not thread-safe. */
+typedef struct {
+  char fmt[PLOT_LABEL_FMT_MAX];
+  time_t t;
+  size_t len;
+  char label[PLOT_LABEL_MAX];
+} PlotLabel;
+
+static PlotLabel label_cache[PLOT_LABEL_CACHE];
+
+void barplot_headless(FILE *sink) {
+  headless = sink;
+}
 
-double frac_of_day_mins(const struct tm *t) {
-  return (t->tm_hour*60 + t->tm_min) /(24.0*1440.0);
+/* The API's offset is that of the current time, so labels are off by
+ * the DST change when it falls into the plotted period */
+time_t local_time(time_t t, double offset) {
+  return t + (time_t) lround(offset * 3600.0);
 }
 
-void barplot_legend(int dx, int dy, int height, double dmax, double dmin) {
-  const int rfac = dmin < 0.0 ? 2 : 1;
+/* Formats t in the local time of the UTC offset in hours into buf,
+ * truncating the label to buflen - 1 bytes */
+void barplot_label(char *buf, size_t buflen, const char *fmt, time_t t, double offset) {
+  const time_t lt = local_time(t, offset);
+  const size_t fmtlen = strlen(fmt);
+  uint32_t h = 2166136261u;
+  PlotLabel *l, tmp;
+  struct tm tm;
+
+  if(buflen == 0)
+    return;
+
+  /* FNV-1a over the format and the time */
+  for(size_t i = 0; i < fmtlen; i++)
+    h = (h ^ (unsigned char) fmt[i]) * 16777619u;
+  h = (h ^ (uint32_t) lt) * 16777619u;
+  h = (h ^ (uint32_t) ((uint64_t) lt >> 32)) * 16777619u;
+  h ^= h >> 16;   /* the index is taken from the low bits */
+
+  l = fmtlen < PLOT_LABEL_FMT_MAX ? &label_cache[h & (PLOT_LABEL_CACHE - 1)] : &tmp;
+  if(l == &tmp || l->t != lt || memcmp(l->fmt, fmt, fmtlen + 1) != 0) {
+    l->len = strftime(l->label, PLOT_LABEL_MAX, fmt, gmtime_r(&lt, &tm));
+    l->label[l->len] = '\0';
+    if(l != &tmp) {
+      memcpy(l->fmt, fmt, fmtlen + 1);
+      l->t = lt;
+    }
+  }
 
-  attron(COLOR_PAIR(PLOT_COLOR_LEGEND));
-  for(int y = dy; y <= dy + rfac*height; y++) {
-    if(y == dy + height) { /* zero-baseline */
-      attron(COLOR_PAIR(PLOT_COLOR_TEXTHIGHLIGHT));
-      mvaddch(y, dx-2, '+');
-      attroff(COLOR_PAIR(PLOT_COLOR_TEXTHIGHLIGHT));
-      attron(COLOR_PAIR(PLOT_COLOR_LEGEND));
-      mvprintw(y, dx-6, "0.0");
-    } else if(y == dy) { /* y-axis maximum */
-      mvaddch(y, dx-2, '|');
-      mvprintw(y,
-          dx-(snprintf(NULL, 0, "%.*f", 1, dmax)+3),
-          "%.*f", 1, dmax);
-    } else if(y == dy + 2*height) { /* y-axis minimum */
-      mvaddch(y, dx-2, '|');
-      mvprintw(y,
-          dx-(snprintf(NULL, 0, "-%.*f", 1, dmax)+3),
-          "-%.*f", 1, dmax);
-    } else
-      mvaddch(y, dx-2, '|');
+  const size_t len = l->len < buflen ? l->len : buflen - 1;
+  memcpy(buf, l->label, len);
+  buf[len] = '\0';
+}
+
+PlotSeries* plotseries_acquire(void) {
+  for(int i = 0; i < PLOT_POOL_SIZE; i++) {
+    if(plot_pool[i].busy == true)
+      continue;
+    if(plot_pool[i].s == NULL) {
+      plot_pool[i].s = malloc(sizeof(PlotSeries));
+      GUARD_ALLOC(plot_pool[i].s, NULL);
+    }
+    plot_pool[i].busy = true;
+    plot_pool[i].s->len = 0;
+    return plot_pool[i].s;
   }
+
+  FERROR(0, "all %d plot buffers are in use", PLOT_POOL_SIZE);
+  return NULL;
+}
+
+void plotseries_release(PlotSeries *s) {
+  for(int i = 0; i < PLOT_POOL_SIZE; i++)
+    if(plot_pool[i].s == s)
+      plot_pool[i].busy = false;
+}
+
+void plotseries_free(void) {
+  for(int i = 0; i < PLOT_POOL_SIZE; i++)
+    if(plot_pool[i].busy == false) {
+      free(plot_pool[i].s);
+      plot_pool[i].s = NULL;
+    }
+}
+
+/* The y axis left of the bars, from up lines above the zero baseline
+ * at y to down lines below it, labelled with the extremes */
+void barplot_legend(int dx, int y, int up, int down, double dmax, double dmin) {
+  attron(COLOR_PAIR(PLOT_COLOR_LEGEND));
+  for(int i = y - up; i <= y + down; i++)
+    mvaddch(i, dx-2, '|');
+  if(up > 0)
+    mvprintw(y - up, dx-(snprintf(NULL, 0, "%.*f", 1, dmax)+3), "%.*f", 1, dmax);
+  if(down > 0)
+    mvprintw(y + down, dx-(snprintf(NULL, 0, "%.*f", 1, dmin)+3), "%.*f", 1, dmin);
+  mvprintw(y, dx-6, "0.0");
   attroff(COLOR_PAIR(PLOT_COLOR_LEGEND));
+
+  attron(COLOR_PAIR(PLOT_COLOR_TEXTHIGHLIGHT));
+  mvaddch(y, dx-2, '+');
+  attroff(COLOR_PAIR(PLOT_COLOR_TEXTHIGHLIGHT));
 }
 
-void start_curses(const PlotCfg *pc) {
+int start_curses(const PlotCfg *pc) {
   int default_color;
 
 /*  setlocale(LC_ALL, ""); */
 
-  /* if this call fails, the program will terminate */
-  initscr();
+  /* newterm() rather than initscr(), which exits if the terminal can't
+   * be set up */
+  if(headless != NULL) {
+    if((headless_screen = newterm(getenv("TERM") ?: "xterm", headless, headless)) == NULL) {
+      FERROR(0, "newterm() failed for the headless plot");
+      return -1;
+    }
+  } else if(newterm(NULL, stdout, stdin) == NULL) {
+    FERROR(0, "newterm() failed for TERM=%s", getenv("TERM") ?: "");
+    return -1;
+  }
 
   /* screen and echo setup */
   cbreak();
@@ -83,12 +177,21 @@ void start_curses(const PlotCfg *pc) {
   init_pair(PLOT_COLOR_LEGEND,        pc->legend.color,               default_color);
   init_pair(PLOT_COLOR_TEXTHIGHLIGHT, pc->legend.texthighlight_color, default_color);
   init_pair(PLOT_COLOR_BAR_OVERLAY,   default_color,                  pc->bar.overlay_color);
+  init_pair(PLOT_COLOR_BAR_OVERLAY2,  default_color,                  pc->bar.overlay2_color);
   init_pair(PLOT_COLOR_PRECIP,        default_color,                  pc->precipitation.bar_color);
   init_pair(PLOT_COLOR_DAYLIGHT,      pc->daylight.color,             default_color);
+
+  return 0;
 }
 
 void end_curses(void) {
   refresh();
+  if(headless_screen != NULL) {
+    endwin();
+    delscreen(headless_screen);
+    headless_screen = NULL;
+    return;
+  }
   getch();
   endwin();
 }
@@ -97,7 +200,7 @@ int terminal_dimen(int *rows, int *cols) {
   struct winsize w;
 
   if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1) {
-    LERROR(0, errno, "ioctl()");
+    FERROR(errno, "ioctl()");
     return -1;
   }
 
@@ -107,280 +210,284 @@ int terminal_dimen(int *rows, int *cols) {
   return 0;
 }
 
-void barplot_scale(const double *d, size_t dlen, int scaleheight, int *scaled, double *scalefac, double *max, double *min) {
-  for(int i = 0; i < dlen; i++) {
-    double m = fabs(d[i]);
-    if(m > *max)
-      *max = m;
-    else if(m < *min)
-      *min = m;
-  }
+/* Scales all series at once to whole lines, at most height of them on
+ * either side of the baseline, into scaled (o->n times o->len values,
+ * one series after another). max and min receive the extremes, which
+ * include 0. Missing values (NaN) are drawn as 0. */
+void barplot_scale(const PlotOverlay *o, int height, int *scaled, double *max, double *min) {
+  double fac;
+
+  *max = *min = 0.0;
+  for(size_t k = 0; k < o->n; k++)
+    for(size_t i = 0; i < o->len; i++) {
+      const double v = o->values[k][i];
+
+      *max = v > *max ? v : *max;
+      *min = v < *min ? v : *min;
+    }
 
-  *scalefac = (double) scaleheight / (*max);
+  fac = *max > -*min ? *max : -*min;
+  fac = fac > 0.0 ? height / fac : 0.0;
 
-  for(int i = 0; i < dlen; i++) {
-    double m = d[i] * (*scalefac);
-    if(m < 0.0)
-      scaled[i] = (int) ceil(m);
-    else if(m > 0.0)
-      scaled[i] = (int) floor(m);
-    else
-      scaled[i] = 0;
+  /* (int) truncates toward the baseline */
+  for(size_t k = 0; k < o->n; k++)
+    for(size_t i = 0; i < o->len; i++) {
+      const double v = o->values[k][i];
+
+      scaled[k * o->len + i] = isnan(v) ? 0 : (int) (v * fac);
+    }
+}
+
+/* Size of the terminal for laying out a plot before curses starts, or
+ * that of a standard one if there is none */
+void terminal_size(int *rows, int *cols) {
+  if(headless != NULL || terminal_dimen(rows, cols) != 0
+      || *rows <= 0 || *cols <= 0) {
+    *rows = 24;
+    *cols = 80;
   }
 }
 
-void barplot(const PlotCfg *c, const double *d, size_t dlen) {
-  int dlist[dlen];
+/* Number of bars that fit into the terminal next to the legend, which
+ * barplot2() needs on both sides as it centers the plot */
+size_t barplot_columns(const PlotCfg *c) {
+  int rows, cols;
 
-  /* scale doubles -> int */
+  terminal_size(&rows, &cols);
+  cols -= 2*PLOT_LEGEND_WIDTH;
 
-  double maxabs = 0.0;
+  return cols > c->bar.width ? (cols + 1) / (c->bar.width + 1) : 1;
+}
 
-  for(int i = 0; i < dlen; i++) {
-    double m = fabs(d[i]);
-    if(m > maxabs)
-      maxabs = m;
-  }
+/* Reduces the dlen values of d to n consecutive buckets of (nearly)
+ * equal size and stores the minimum, maximum or mean of each in out.
+ * Every value is visited once, and the inner loops don't branch. */
+void barplot_downsample(const double *d, size_t dlen, size_t n, int aggregate, double *out) {
+  if(n > dlen)
+    n = dlen;
+
+  for(size_t b = 0; b < n; b++) {
+    const size_t from = b * dlen / n;
+    const size_t to = (b + 1) * dlen / n;
+    double acc = d[from];
+
+    switch(aggregate) {
+      case PLOT_AGGREGATE_MAX:
+        for(size_t i = from + 1; i < to; i++)
+          acc = d[i] > acc ? d[i] : acc;
+        break;
+      case PLOT_AGGREGATE_MIN:
+        for(size_t i = from + 1; i < to; i++)
+          acc = d[i] < acc ? d[i] : acc;
+        break;
+      case PLOT_AGGREGATE_MEAN:
+        for(size_t i = from + 1; i < to; i++)
+          acc += d[i];
+        acc /= (double) (to - from);
+        break;
+    }
 
-  const double fac = (double) c->height / maxabs;
-  int maxdlist = 0;
-
-  for(int i = 0; i < dlen; i++) {
-    double m = d[i] * fac;
-    if(m < 0.0)
-      dlist[i] = (int) ceil(m);
-    else if(m > 0.0)
-      dlist[i] = (int) floor(m);
-    else
-      dlist[i] = 0;
-    if(dlist[i] > maxdlist)
-      maxdlist = dlist[i];
+    out[b] = acc;
   }
+}
 
-  /* tic labels on y axis */
-  /* FIXME: Maybe use the non-extreme tics in the legend, too? */
-
-  double ticnames[c->height + 1];
-  ticnames[0] = 0.0;
-  for(int i = 1; i <= c->height; i++)
-    ticnames[i] = (1.0/fac) * (double) i;
-
-  /* curses */
-
-  start_curses(c);
-
-  const int dx = COLS/2 - (dlen * (c->bar.width + 1) - 1)/2;
-  const int dy = LINES/2 - c->height;
-
-  /* plot the decoration and legend */
-
-  attron(COLOR_PAIR(2));
-  for(int y = dy; y <= dy + 2*c->height; y++) {
-    if(y == dy + c->height) { /* zero-baseline */
-      attron(COLOR_PAIR(3));
-      mvaddch(y, dx-2, '+');
-      attroff(COLOR_PAIR(3));
-      attron(COLOR_PAIR(2));
-
-      mvprintw(y, dx-6, "0.0");
-    } else if(y == dy) { /* y-axis maximum */
-      mvaddch(y, dx-2, '|');
-      mvprintw(y,
-          dx-(snprintf(NULL, 0, "%.*f", 1, ticnames[c->height])+3),
-          "%.*f", 1, ticnames[c->height]);
-    } else if(y == dy + 2*c->height) { /* y-axis minimum */
-      mvaddch(y, dx-2, '|');
-      mvprintw(y,
-          dx-(snprintf(NULL, 0, "-%.*f", 1, ticnames[c->height])+3),
-          "-%.*f", 1, ticnames[c->height]);
-    } else
-      mvaddch(y, dx-2, '|');
-  }
-  attroff(COLOR_PAIR(2));
-
-  int offset = 0;
-  for(int i = 0; i < dlen; i++) {
-    const int d = dlist[i] >= 0 ? 1 : -1;
-    const int _offset = offset;
-    char barlabel[5];
-
-    snprintf(barlabel, 5, " %02d ", i);
-    attron(COLOR_PAIR(2));
-    mvprintw(dy + c->height, dx + i + offset, barlabel);
-    attroff(COLOR_PAIR(2));
-
-    for(int j = dx + i + offset; j < dx + i + c->bar.width + _offset; j++, offset++) {
-      attron(COLOR_PAIR(1));
-      for(int y = dy + c->height - dlist[i]; y != dy + c->height; y += d)
-        mvaddch(y, j, ' ');
-      attroff(COLOR_PAIR(1));
-    }
+/* Draws the series with the bar labels on the baseline, which is
+ * placed so that the plot is centered on the terminal */
+int barplot_series(const PlotCfg *pc, const PlotOverlay *o) {
+  int scaled[PLOT_OVERLAY_MAX * PLOT_SERIES_MAX];
+  PlotOverlay c = *o;
+  double dmax, dmin;
+  int up = 0, down = 0;
+
+  if(c.n > PLOT_OVERLAY_MAX)
+    c.n = PLOT_OVERLAY_MAX;
+  if(c.len > PLOT_SERIES_MAX)
+    c.len = PLOT_SERIES_MAX;
+
+  barplot_scale(&c, pc->height, scaled, &dmax, &dmin);
+  for(size_t i = 0; i < c.n * c.len; i++) {
+    up = scaled[i] > up ? scaled[i] : up;
+    down = -scaled[i] > down ? -scaled[i] : down;
   }
 
-  /* display, and uninit curses */
+  if(start_curses(pc) != 0)
+    return -1;
 
-  end_curses();
-}
+  const int dx = COLS/2 - ((int) c.len * (pc->bar.width + 1) - 1)/2;
+  const int y0 = (LINES - up - down - 1)/2 + up;
 
-void barplot2(const PlotCfg *pc, const double *d, char **labels, size_t dlen, int bar_color) {
-  int ds[dlen];
-  double sfac, dmax, dmin;
+  barplot_legend(dx, y0, up, down, dmax, dmin);
 
-  barplot_scale(d, dlen, pc->height, &ds[0], &sfac, &dmax, &dmin);
+  for(size_t i = 0; i < c.len; i++) {
+    const int x0 = dx + i * (pc->bar.width + 1);
+    size_t order[PLOT_OVERLAY_MAX];
 
-  start_curses(pc);
+    /* The longest bar first, so that the shorter ones stay visible */
+    for(size_t k = 0; k < c.n; k++) {
+      size_t j = k;
 
-  const int dx = COLS/2 - (dlen * (pc->bar.width + 1) - 1)/2;
-  const int dy = LINES/2 - pc->height;
+      for(; j > 0 && abs(scaled[order[j-1] * c.len + i]) < abs(scaled[k * c.len + i]); j--)
+        order[j] = order[j-1];
+      order[j] = k;
+    }
 
-  barplot_legend(dx, dy, pc->height, dmax, dmin);
+    for(size_t j = 0; j < c.n; j++) {
+      const size_t k = order[j];
+      const int v = scaled[k * c.len + i];
+      const int delta = v >= 0 ? 1 : -1;
 
-  int offset = 0;
-  for(int i = 0; i < dlen; i++) {
-    const int delta = ds[i] >= 0 ? 1 : -1;
-    const int _offset = offset;
+      attron(COLOR_PAIR(c.colors[k]));
+      for(int x = x0; x < x0 + pc->bar.width; x++)
+        for(int y = y0 - v; y != y0; y += delta)
+          mvaddch(y, x, ' ');
+      attroff(COLOR_PAIR(c.colors[k]));
+    }
 
     attron(COLOR_PAIR(PLOT_COLOR_LEGEND));
-    mvprintw(dy + pc->height, dx + i + offset, "%s", labels[i]);
+    mvprintw(y0, x0, "%s", c.labels[i]);
     attroff(COLOR_PAIR(PLOT_COLOR_LEGEND));
-
-    for(int j = dx + i + offset; j < dx + i + pc->bar.width + _offset; j++, offset++) {
-      attron(COLOR_PAIR(bar_color));
-      for(int y = dy + pc->height - ds[i]; y != dy + pc->height; y += delta)
-        mvaddch(y, j, ' ');
-      attroff(COLOR_PAIR(bar_color));
-    }
   }
 
   end_curses();
+
+  return 0;
 }
 
-void barplot_overlaid(const PlotCfg *pc, const double *d1, const double *d2, char **labels, size_t dlen) {
-  double  d[2*dlen];
-  int     ds[2*dlen];
-  double  sfac;
-  double  dmax;
-  double  dmin;
+/* A single series */
+int barplot2(const PlotCfg *pc, const double *d, char **labels, size_t dlen, int bar_color) {
+  const PlotOverlay o = {
+    .n = 1,
+    .len = dlen,
+    .values = { d },
+    .colors = { bar_color },
+    .labels = labels
+  };
+
+  return barplot_series(pc, &o);
+}
 
-  memcpy(&d, d1, dlen * sizeof(double));
-  memcpy(&d[dlen], d2, dlen * sizeof(double));
+/* Minutes since local midnight */
+int minute_of_day(time_t t, double offset) {
+  const time_t lt = local_time(t, offset);
+  struct tm tm;
 
-  barplot_scale(d, 2*dlen, pc->height, &ds[0], &sfac, &dmax, &dmin);
+  gmtime_r(&lt, &tm);
+  return tm.tm_hour * 60 + tm.tm_min;
+}
 
-  start_curses(pc);
+/* Draws the days one per line, from midnight to midnight, with the time
+ * between sunrise and sunset filled in:
+ *
+ *   DATE  SUNRISE |00    06    12    18    |24 SUNSET
+ *
+ * The layout is worked out before drawing anything: the labels go to
+ * s->labels (date, sunrise, sunset for each day) and the sunrise and
+ * sunset columns relative to the bar to s->scaled, all in the one
+ * PlotSeries buffer. A day without sunrise or sunset, as in polar
+ * summer or winter, is drawn empty. */
+int barplot_daylight(const PlotCfg *pc, const time_t *times, size_t days, double offset) {
+  PlotSeries *s;
+  int rows, cols;
+  int datew = 0, timew = 0;
+  int barwidth, width;
+  int n = days < PLOT_SERIES_MAX ? days : PLOT_SERIES_MAX;
+
+  if((s = plotseries_acquire()) == NULL)
+    return -1;
 
-  const int dx = COLS/2 - (dlen * (pc->bar.width + 1) - 1)/2;
-  const int dy = LINES/2 - pc->height;
+  /* one line per day below the hour axis */
+  terminal_size(&rows, &cols);
+  if(n > rows - 2)
+    n = rows > 2 ? rows - 2 : 1;
 
-  barplot_legend(dx, dy, pc->height, dmax, dmin);
+  /* Layout: labels and their widths */
+  for(int i = 0; i < n; i++)
+    for(int j = 0; j < 3; j++) {
+      const time_t t = times[3*i + j];
+      const char *fmt = j == 0 ? pc->daylight.date_label_format ?: "%d%b"
+                               : pc->daylight.time_label_format ?: "%H:%M";
+      char *label = s->labels[3*i + j];
+      int len;
+
+      if(j > 0 && t == 0)
+        strcpy(label, "-");
+      else
+        barplot_label(label, PLOT_LABEL_MAX, fmt, t, offset);
+
+      len = strlen(label);
+      if(j == 0 && len > datew)
+        datew = len;
+      else if(j > 0 && len > timew)
+        timew = len;
+    }
 
-  int offset = 0;
-  for(int i = 0; i < dlen; i++) {
-    const int _offset = offset;
+  /* Layout: the bar takes what is left of the configured width */
+  width = pc->daylight.width_frac * cols;
+  if(width > pc->daylight.width_max)
+    width = pc->daylight.width_max;
+  barwidth = width - datew - 2*timew - 5;
+  if(barwidth < 24)
+    barwidth = 24;
+  width = datew + 2*timew + barwidth + 5;
+
+  /* Layout: sunrise and sunset columns within the bar */
+  for(int i = 0; i < n; i++) {
+    const time_t rise = times[3*i + 1];
+    const time_t set = times[3*i + 2];
+
+    if(rise == 0 || set == 0) {
+      s->scaled[2*i] = s->scaled[2*i + 1] = 0;
+      continue;
+    }
+    s->scaled[2*i] = minute_of_day(rise, offset) * barwidth / 1440;
+    s->scaled[2*i + 1] = minute_of_day(set, offset) * barwidth / 1440;
+  }
 
-    attron(COLOR_PAIR(PLOT_COLOR_LEGEND));
-    mvprintw(dy + pc->height, dx + i + offset, "%s", labels[i]);
-    attroff(COLOR_PAIR(PLOT_COLOR_LEGEND));
+  if(start_curses(pc) != 0) {
+    plotseries_release(s);
+    return -1;
+  }
 
-    for(int j = dx + i + offset; j < dx + i + pc->bar.width + _offset; j++, offset++) {
-      for(int k = 0; k < 2; k++) {
-        const int idx = i + k * dlen;
-        const int d = ds[idx] >= 0 ? 1 : -1;
-        const int barcoloridx = (k == 0) ? PLOT_COLOR_BAR : PLOT_COLOR_BAR_OVERLAY;
+  const int dx = COLS > width ? (COLS - width) / 2 : 0;
+  const int dy = LINES > n + 1 ? (LINES - n - 1) / 2 : 0;
+  const int bx = dx + datew + timew + 3;
 
-        attron(COLOR_PAIR(barcoloridx));
-        for(int y = dy + pc->height - ds[idx]; y != dy + pc->height; y += d)
-          mvaddch(y, j, ' ');
-        attroff(COLOR_PAIR(barcoloridx));
-      } // for k
-    } // for j
+  /* hour axis above the bars */
+  attron(COLOR_PAIR(PLOT_COLOR_LEGEND));
+  for(int h = 0; h < 24; h += 6)
+    mvprintw(dy, bx + h * barwidth / 24, "%02d", h);
+  mvprintw(dy, bx + barwidth - 2, "24");
+  attroff(COLOR_PAIR(PLOT_COLOR_LEGEND));
 
-  } // for i
+  for(int i = 0; i < n; i++) {
+    const int y = dy + 1 + i;
+    const int rise = s->scaled[2*i];
+    const int set = s->scaled[2*i + 1];
 
-  end_curses();
-}
+    attron(COLOR_PAIR(PLOT_COLOR_LEGEND));
+    mvprintw(y, dx, "%s", s->labels[3*i]);
+    mvprintw(y, bx - 2 - strlen(s->labels[3*i + 1]), "%s", s->labels[3*i + 1]);
+    mvaddch(y, bx - 1, '|');
+    mvaddch(y, bx + barwidth, '|');
+    mvprintw(y, bx + barwidth + 2, "%s", s->labels[3*i + 2]);
+    attroff(COLOR_PAIR(PLOT_COLOR_LEGEND));
 
-void barplot_daylight(const PlotCfg *pc, const int *times, size_t days) {
-  int barwidth;
-  double scalefac, min, max;
-  /* If we were to do things correctly, we would need to loop over the
-   * date formats of the current locale and determine their maximum
-   * length */
-  char date_label[days][255];
-  char atime_label[days][255];
-  char btime_label[days][255];
-  int dlabel_max = 0;
-  int alabel_max = 0;
-  int blabel_max = 0;
-
-  double data[2*days+2]; /* +2 for 0h-24h extremes */
-  int di = 0;
-  int data_scaled[2*days+2];
-
-  for(int i = 0; i < days; i++)
-    for(int j = 0; j < 3; j++) {
-      int k = 3 * i + j;
-      time_t t = times[k];
-      struct tm *uxt = gmtime(&t);
-      char *lptr, *fmt;
-      int *comp;
-
-      switch(j) {
-        case 0:
-          lptr = &date_label[k][0];
-          fmt = pc->daylight.date_label_format;
-          comp = &dlabel_max;
-          break;
-        case 1:
-          lptr = &atime_label[k][0];
-          fmt = pc->daylight.time_label_format;
-          comp = &alabel_max;
-          data[di++] = frac_of_day_mins((const struct tm*)uxt);
-          break;
-        case 2:
-          lptr = &btime_label[k][0];
-          fmt = pc->daylight.time_label_format;
-          comp = &blabel_max;
-          data[di++] = frac_of_day_mins((const struct tm*)uxt);
-          break;
-      }
-      strftime(lptr, 255, (const char*)fmt, (const struct tm*)&uxt);
-      if(strlen(lptr) > *comp)
-        *comp = strlen(lptr);
+    /* Daylight may wrap around midnight where the time zone is far
+     * from solar time */
+    for(int x = 0; x < barwidth; x++) {
+      const bool day = rise <= set ? x >= rise && x < set : x >= rise || x < set;
+
+      if(day) {
+        attron(COLOR_PAIR(PLOT_COLOR_DAYLIGHT) | A_REVERSE);
+        mvaddch(y, bx + x, ' ');
+        attroff(COLOR_PAIR(PLOT_COLOR_DAYLIGHT) | A_REVERSE);
+      } else
+        mvaddch(y, bx + x, ' ');
     }
-
-//  terminal_dimen(&rows, &cols);
-
-  /* Scale over [0.0, 24.0]*60 */
-  data[di++] = 0.0;
-  data[di++] = 1440.0;
-  barplot_scale((const double*)&data[0], 2*days+2, barwidth, &data_scaled[0], &scalefac, &max, &min);
-
-  start_curses(pc);
-
-  const int dx = 0.5 * (COLS - barwidth);
-  const int dy = 0.5 * (LINES - days);
-  barwidth = pc->daylight.width_frac * LINES > pc->daylight.width_max ?
-    pc->daylight.width_max : pc->daylight.width_frac * LINES;
-
-  LERROR(0, 0, "barwidth=%d", barwidth);
-
-  for(int y = 0; y < days; y++) {
-    /* plot background */
-    for(int x = dx; x < dx + barwidth; x++)
-      LERROR(0, 0, "y = %d, x = %d",dy +y, x);
-//      mvaddch(dy + y, x, ' ');
-    /* plot daylight */
-    /*
-    attron(COLOR_PAIR(PLOT_COLOR_DAYLIGHT));
-    for(int x = dx + data_scaled[y]; x < dx + data_scaled[2*y]; x++)
-      mvaddch(dy + y, x, ' ');
-    attroff(COLOR_PAIR(PLOT_COLOR_DAYLIGHT));
-    */
   }
 
-  //end_curses();
-  
+  end_curses();
+  plotseries_release(s);
 
-  return;
+  return 0;
 }
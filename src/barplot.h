@@ -26,6 +26,7 @@
 #include <locale.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,16 +39,27 @@ enum {
   PLOT_COLOR_TEXTHIGHLIGHT  = 3,
   PLOT_COLOR_BAR_OVERLAY    = 4,
   PLOT_COLOR_PRECIP         = 5,
-  PLOT_COLOR_DAYLIGHT       = 6
+  PLOT_COLOR_DAYLIGHT       = 6,
+  PLOT_COLOR_BAR_OVERLAY2   = 7
 };
 
+/* How barplot_downsample() represents the values of a bucket */
+enum {
+  PLOT_AGGREGATE_MAX,
+  PLOT_AGGREGATE_MEAN,
+  PLOT_AGGREGATE_MIN
+};
+
+#define PLOT_OVERLAY_MAX 3      /* series drawn over each other */
+
 #define PLOTCFG_DEFAULT               \
 {                                     \
   .height = 6,                        \
   .bar = {                            \
     .width = 2,                       \
     .color = COLOR_BLACK,             \
-    .overlay_color = COLOR_RED        \
+    .overlay_color = COLOR_RED,       \
+    .overlay2_color = COLOR_CYAN      \
   },                                  \
   .legend = {                         \
     .color = COLOR_WHITE,             \
@@ -55,7 +67,8 @@ enum {
   },                                  \
   .hourly = {                         \
     .succeeding_hours = 10,           \
-    .label_format = NULL              \
+    .label_format = NULL,             \
+    .fields_len = 0                   \
   },                                  \
   .daily = {                          \
     .label_format = NULL              \
@@ -64,6 +77,10 @@ enum {
     .label_format = NULL,             \
     .bar_color = COLOR_BLUE           \
   },                                  \
+  .minutely = {                       \
+    .label_format = NULL,             \
+    .aggregate = PLOT_AGGREGATE_MAX   \
+  },                                  \
   .daylight = {                       \
     .width_frac = 0.75,               \
     .width_max = 72,                  \
@@ -79,6 +96,7 @@ typedef struct {
     int width;
     int color;
     int overlay_color;
+    int overlay2_color;
   } bar;
   struct {
     int color;
@@ -87,6 +105,8 @@ typedef struct {
   struct {
     int succeeding_hours;
     char *label_format;
+    int fields[PLOT_OVERLAY_MAX]; /* datapoint_fields[] indices, or */
+    int fields_len;               /* 0 for the temperature */
   } hourly;
   struct {
     char *label_format;
@@ -95,6 +115,10 @@ typedef struct {
     char *label_format;
     int bar_color;
   } precipitation;
+  struct {
+    char *label_format;
+    int aggregate;      /* PLOT_AGGREGATE_* */
+  } minutely;
   struct {
     double width_frac;
     int width_max;
@@ -104,10 +128,48 @@ typedef struct {
   } daylight;
 } PlotCfg;
 
-void barplot(const PlotCfg *c, const double *d, size_t dlen);
-void barplot2(const PlotCfg *c, const double *d, char **labels, size_t dlen, int color);
-void barplot_overlaid(const PlotCfg *c, const double *d1, const double *d2, char **labels, size_t dlen);
-void barplot_daylight(const PlotCfg *c, const int *times, size_t dlen);
+/* Upper bounds of what a plot draws, so that the size of a response
+ * never decides the size of a buffer. Longer series are cut off. */
+#define PLOT_SERIES_MAX 168     /* a week of hourly data points */
+#define PLOT_LABEL_MAX  64      /* bytes per label, NUL included */
+#define PLOT_POOL_SIZE  2
+#define PLOT_LEGEND_WIDTH 8     /* columns left of the bars */
+#define PLOT_LABEL_CACHE 256    /* formatted labels kept, a power of two */
+#define PLOT_LABEL_FMT_MAX 32   /* longer formats aren't cached */
+
+/* Scratch space for one plot. Buffers come from a small pool and are
+ * kept after plotseries_release(), so redrawing a plot doesn't allocate
+ * anything. Like the plots themselves, the pool is not thread-safe. */
+typedef struct {
+  size_t len;                                   /* data points in use */
+  double values[PLOT_OVERLAY_MAX*PLOT_SERIES_MAX]; /* one series after another */
+  int scaled[2*PLOT_SERIES_MAX];                /* sunrise and sunset columns */
+  char labels[3*PLOT_SERIES_MAX][PLOT_LABEL_MAX]; /* up to three per point */
+  char *plabels[PLOT_SERIES_MAX];
+} PlotSeries;
+
+/* Series of equal length drawn over each other as bars, each in its own
+ * color pair (PLOT_COLOR_*). The shortest bar is drawn on top. */
+typedef struct {
+  size_t n;                                 /* series in use */
+  size_t len;                               /* values per series */
+  const double *values[PLOT_OVERLAY_MAX];
+  int colors[PLOT_OVERLAY_MAX];
+  char **labels;                            /* len bar labels */
+} PlotOverlay;
+
+PlotSeries* plotseries_acquire(void);
+void plotseries_release(PlotSeries *s);
+void plotseries_free(void);
+
+void barplot_headless(FILE *sink);
+void barplot_label(char *buf, size_t buflen, const char *fmt, time_t t, double offset);
+void barplot_scale(const PlotOverlay *o, int height, int *scaled, double *max, double *min);
+size_t barplot_columns(const PlotCfg *c);
+void barplot_downsample(const double *d, size_t dlen, size_t n, int aggregate, double *out);
+int barplot_series(const PlotCfg *c, const PlotOverlay *o);
+int barplot2(const PlotCfg *c, const double *d, char **labels, size_t dlen, int color);
+int barplot_daylight(const PlotCfg *c, const time_t *times, size_t dlen, double offset);
 int terminal_dimen(int *rows, int *cols);
 
 #endif
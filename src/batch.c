@@ -0,0 +1,124 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batch.h"
+
+/* Runs work() for every location on a pool of threads. done() is called
+ * from the calling thread, in the order of the locations, as soon as a
+ * job and all jobs before it have finished, so output stays the same
+ * however the jobs were scheduled. */
+
+typedef struct {
+  const Config *c;
+  BatchJob *jobs;
+  bool *finished;
+  int len;
+  int next;
+  BatchWorkFunc work;
+  void *arg;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Batch;
+
+static void* batch_worker(void *p);
+
+void* batch_worker(void *p) {
+  Batch *b = (Batch*) p;
+
+  for(;;) {
+    BatchJob *j;
+    int i;
+
+    pthread_mutex_lock(&b->lock);
+    i = b->next < b->len ? b->next++ : -1;
+    pthread_mutex_unlock(&b->lock);
+
+    if(i == -1)
+      break;
+
+    j = &b->jobs[i];
+    if((j->status = b->work(b->c, j, b->arg)) != 0)
+      strncpy(j->error, forecast_strerror(), sizeof(j->error) - 1);
+
+    pthread_mutex_lock(&b->lock);
+    b->finished[i] = true;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+  }
+
+  return NULL;
+}
+
+int batch_run(const Config *c, const Location *locations, int len, int threads,
+    BatchWorkFunc work, BatchDoneFunc done, void *arg) {
+  Batch b = {
+    .c = c,
+    .len = len,
+    .next = 0,
+    .work = work,
+    .arg = arg
+  };
+  pthread_t *tids = NULL;
+  int started = 0;
+
+  if(threads > len)
+    threads = len;
+
+  b.jobs = calloc(len, sizeof(BatchJob));
+  GUARD_ALLOC(b.jobs, -1);
+  if((b.finished = calloc(len, sizeof(bool))) == NULL) {
+    FERROR(errno, "calloc()");
+    free(b.jobs);
+    return -1;
+  }
+  for(int i = 0; i < len; i++)
+    b.jobs[i].location = &locations[i];
+
+  pthread_mutex_init(&b.lock, NULL);
+  pthread_cond_init(&b.cond, NULL);
+
+  if(threads > 1 && (tids = calloc(threads, sizeof(pthread_t))) != NULL)
+    for(; started < threads; started++)
+      if(pthread_create(&tids[started], NULL, batch_worker, &b) != 0)
+        break;
+
+  /* Without any worker threads, do all the work right here */
+  if(started == 0)
+    batch_worker(&b);
+
+  for(int i = 0; i < len; i++) {
+    pthread_mutex_lock(&b.lock);
+    while(b.finished[i] == false)
+      pthread_cond_wait(&b.cond, &b.lock);
+    pthread_mutex_unlock(&b.lock);
+
+    done(c, &b.jobs[i], arg);
+    free(b.jobs[i].out);
+  }
+
+  for(int i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  pthread_cond_destroy(&b.cond);
+  pthread_mutex_destroy(&b.lock);
+  free(tids);
+  free(b.finished);
+  free(b.jobs);
+
+  return 0;
+}
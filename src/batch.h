@@ -0,0 +1,46 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "forecast.h"
+#include "timings.h"
+
+typedef struct {
+  const Location *location;
+  int status;                       /* return value of the work function */
+  char *out;                        /* output of the job, free()d by batch_run() */
+  size_t outlen;
+  char error[FORECAST_ERROR_MAX];   /* forecast_strerror() if status != 0, or why
+                                     * an expired forecast was served */
+  Timings timings;
+} BatchJob;
+
+typedef int   (*BatchWorkFunc)(const Config *c, BatchJob *job, void *arg);
+typedef void  (*BatchDoneFunc)(const Config *c, const BatchJob *job, void *arg);
+
+int batch_run(const Config *c, const Location *locations, int len, int threads,
+    BatchWorkFunc work, BatchDoneFunc done, void *arg);
+
+#endif
@@ -1,34 +1,40 @@
 #include "cache.h"
+#include "codec.h"
+#include "metrics.h"
+#include "probes.h"
 
-static int check_cache_file(const Config*);
+static int check_cache_file(const Location*);
+static int read_cache_file(const Location*, Data*);
+static time_t payload_time(const char *json, const char *block);
 
-int check_cache_file(const Config *c) {
+int check_cache_file(const Location *l) {
   struct stat s;
   struct timeval tv;
 
+  /* Ad-hoc locations are never cached */
+  if(l->cache_file == NULL)
+    return -1;
+
   /* Check cache file accssibility */
-  if(access(c->cache_file, F_OK | R_OK) != 0)
+  if(access(l->cache_file, F_OK | R_OK) != 0)
     return -1;
 
   /* Check cache file age */
-  if(stat(c->cache_file, &s) != 0)
+  if(stat(l->cache_file, &s) != 0)
     return -1;
   gettimeofday(&tv, NULL);
-  if((tv.tv_sec - s.st_mtim.tv_sec) >= c->max_cache_age)
+  if((tv.tv_sec - s.st_mtim.tv_sec) >= l->max_cache_age)
     return -1;
 
   return 0;
 }
 
-int load_cache(const Config *c, Data *d) {
+int read_cache_file(const Location *l, Data *d) {
   FILE *cf;
   long cflen;
 
-  if(check_cache_file(c) != 0)
-    return  -1;
-
-  if((cf = fopen(c->cache_file, "rb")) == NULL) {
-    LERROR(0, errno, "fopen()");
+  if((cf = fopen(l->cache_file, "rb")) == NULL) {
+    FERROR(errno, "fopen(%s)", l->cache_file);
     return -1;
   }
 
@@ -36,30 +42,144 @@ int load_cache(const Config *c, Data *d) {
   cflen = ftell(cf);
   fseek(cf, 0, SEEK_SET);
 
-  d->data = malloc(cflen + 1);
-  GUARD_MALLOC(d->data);
+  if((d->data = malloc(cflen + 1)) == NULL) {
+    FERROR(errno, "malloc()");
+    fclose(cf);
+    return -1;
+  }
   d->datalen = cflen;
-  fread(d->data, cflen, 1, cf);
+  if(fread(d->data, cflen, 1, cf) != 1 && cflen > 0) {
+    FERROR(0, "short read from %s", l->cache_file);
+    free(d->data);
+    *d = (Data) DATA_NULL;
+    fclose(cf);
+    return -1;
+  }
+  d->data[cflen] = '\0';
   fclose(cf);
 
+  if(codec_unpack(d) != 0) {
+    free(d->data);
+    *d = (Data) DATA_NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* The time of the currently block, or of the first data point of
+ * another block, found without parsing the payload; 0 if there is none.
+ * The blocks are flat objects of numbers and plain strings, so the
+ * first closing brace after the opening one ends them. */
+time_t payload_time(const char *json, const char *block) {
+  char key[16];
+  const char *p, *end;
+
+  snprintf(key, sizeof(key), "\"%s\"", block);
+  if((p = strstr(json, key)) == NULL || (p = strchr(p, '{')) == NULL)
+    return 0;
+  if(strcmp(block, "currently") != 0
+      && ((p = strstr(p, "\"data\"")) == NULL || (p = strchr(p, '{')) == NULL))
+    return 0;
+  if((end = strchr(p, '}')) == NULL || (p = strstr(p, "\"time\"")) == NULL || p > end)
+    return 0;
+  for(p += 6; *p == ' ' || *p == ':'; p++)
+    ;
+  return (time_t) strtoll(p, NULL, 10);
+}
+
+/* With CACHE_EXPIRY_DATA, an entry is out of date once the hour of its
+ * first hourly data point is over, as the series has moved on by then,
+ * or once its currently block was observed more than max_data_age
+ * seconds ago. Blocks that weren't requested don't count. d is
+ * decompressed to look inside. Returns 1 if the entry is out of date,
+ * 0 if not and -1 on error. */
+int cache_outdated(const Location *l, Data *d, time_t now) {
+  time_t t;
+
+  if(l->cache_expiry != CACHE_EXPIRY_DATA)
+    return 0;
+  if(codec_decompress(d) != 0)
+    return -1;
+
+  if((t = payload_time(d->data, "hourly")) != 0 && now >= t + 3600)
+    return 1;
+  if(l->max_data_age > 0
+      && (t = payload_time(d->data, "currently")) != 0 && now - t >= l->max_data_age)
+    return 1;
+
+  return 0;
+}
+
+int load_cache(const Location *l, Data *d) {
+  if(check_cache_file(l) != 0) {
+    PROBE1(cache__miss, PROBE_LOCATION(l));
+    metrics_count(METRIC_CACHE_MISSES, 1);
+    return  -1;
+  }
+
+  if(read_cache_file(l, d) != 0)
+    return -1;
+
+  if(cache_outdated(l, d, time(NULL)) != 0) {
+    free(d->data);
+    *d = (Data) DATA_NULL;
+    PROBE1(cache__miss, PROBE_LOCATION(l));
+    metrics_count(METRIC_CACHE_MISSES, 1);
+    return -1;
+  }
+
+  PROBE2(cache__hit, PROBE_LOCATION(l), d->datalen);
+  metrics_count(METRIC_CACHE_HITS, 1);
+
   return 0;
 }
 
-int save_cache(const Config *c, const Data *d) {
+/* Loads whatever was cached last, regardless of its age */
+int load_cache_stale(const Location *l, Data *d) {
+  if(l->cache_file == NULL) {
+    FERROR(0, "location is not cached");
+    return -1;
+  }
+
+  return read_cache_file(l, d);
+}
+
+int save_cache(const Location *l, const Data *d) {
+  Data packed = DATA_NULL;
   int fd;
   int ret = 0;
 
-  if((fd = open(c->cache_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1)
+  if(l->cache_file == NULL)
+    return 0;
+
+  if(d->codec != CODEC_NONE) {
+    FERROR(0, "only uncompressed data can be cached");
     return -1;
+  }
+
+  /* Compression is an optimization, so fall back to storing plain JSON */
+  if(l->compress == true && codec_pack(d, &packed) == 0)
+    d = &packed;
+
+  if((fd = open(l->cache_file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1) {
+    FERROR(errno, "open(%s)", l->cache_file);
+    free(packed.data);
+    return -1;
+  }
 
   ret = write(fd, (const void*) d->data, d->datalen);
 
   if(ret == -1 || ret < d->datalen) {
-    LERROR(0, errno, "write()");
+    FERROR(errno, "write(%s)", l->cache_file);
     ret = -1;
-  }
+  } else
+    ret = 0;
 
   close(fd);
 
+  PROBE3(cache__save, PROBE_LOCATION(l), d->datalen, ret);
+  free(packed.data);
+
   return ret;
 }
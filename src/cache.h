@@ -8,11 +8,15 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "forecast.h"
 
-int load_cache(const Config*, Data*);
-int save_cache(const Config*, const Data*);
+int load_cache(const Location*, Data*);
+int cache_outdated(const Location*, Data*, time_t now);
+int load_cache_stale(const Location*, Data*);
+int save_cache(const Location*, const Data*);
 
 #endif
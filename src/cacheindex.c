@@ -0,0 +1,441 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "cacheindex.h"
+
+#define CACHEINDEX_MAGIC    "FCIDX1"
+#define CAPACITY_MIN        1024
+/* compact when the payloads referenced are less than half the data file */
+#define GARBAGE_MIN         (1 << 20)
+
+struct CacheIndexHeader {
+  char magic[8];
+  uint32_t capacity;    /* power of two */
+  uint32_t used;
+  uint32_t deleted;
+  uint32_t generation;  /* of the data file */
+  uint64_t live;        /* payload bytes referenced */
+  char reserved[32];
+};
+
+enum {
+  SLOT_EMPTY,
+  SLOT_USED,
+  SLOT_DELETED
+};
+
+static uint64_t hash(uint64_t x);
+static uint32_t slot_crc(const CacheIndexSlot *s);
+static int      slot_state(const CacheIndexSlot *s);
+static uint32_t slot_find(const CacheIndexSlot *slots, uint32_t capacity, uint64_t bucket,
+                  const char *key, bool *existing);
+static int      sync_range(const void *p, size_t len);
+static int      map_index(CacheIndex *ci, int fd, bool init, uint32_t capacity, uint32_t generation);
+static int      open_data(CacheIndex *ci, uint32_t generation, int flags);
+
+/* splitmix64 finalizer: neighbouring buckets end up far apart */
+uint64_t hash(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+uint32_t slot_crc(const CacheIndexSlot *s) {
+  return crc32(0, (const Bytef*) s, offsetof(CacheIndexSlot, crc));
+}
+
+/* A slot that doesn't match its checksum was torn while being written
+ * and may be part of a probe sequence, so it counts as deleted */
+int slot_state(const CacheIndexSlot *s) {
+  if(s->state == SLOT_EMPTY && s->crc == 0)
+    return SLOT_EMPTY;
+  if(s->crc != slot_crc(s))
+    return SLOT_DELETED;
+  return s->state;
+}
+
+/* The slot holding key, or else the first free one of its probe sequence */
+uint32_t slot_find(const CacheIndexSlot *slots, uint32_t capacity, uint64_t bucket,
+    const char *key, bool *existing) {
+  uint32_t i = hash(bucket) & (capacity - 1);
+  uint32_t target = UINT32_MAX;
+
+  *existing = false;
+
+  for(uint32_t n = 0; n < capacity; n++, i = (i + 1) & (capacity - 1)) {
+    const int st = slot_state(&slots[i]);
+    if(st == SLOT_EMPTY)
+      break;
+    if(st == SLOT_USED && slots[i].bucket == bucket && strcmp(slots[i].key, key) == 0) {
+      *existing = true;
+      return i;
+    }
+    if(st == SLOT_DELETED && target == UINT32_MAX)
+      target = i;
+  }
+
+  return target != UINT32_MAX ? target : i;
+}
+
+int sync_range(const void *p, size_t len) {
+  const long page = sysconf(_SC_PAGESIZE);
+  const uintptr_t start = (uintptr_t) p & ~(uintptr_t)(page - 1);
+
+  if(msync((void*) start, (uintptr_t) p + len - start, MS_SYNC) != 0) {
+    FERROR(errno, "msync()");
+    return -1;
+  }
+  return 0;
+}
+
+int open_data(CacheIndex *ci, uint32_t generation, int flags) {
+  char path[PATH_MAX];
+
+  snprintf(path, sizeof(path), "%s.data.%u", ci->base, generation);
+  if((ci->datafd = open(path, flags, S_IRUSR | S_IWUSR)) == -1) {
+    FERROR(errno, "open(%s)", path);
+    return -1;
+  }
+  return 0;
+}
+
+/* Maps the index in fd, sizing and initializing it first if init is set */
+int map_index(CacheIndex *ci, int fd, bool init, uint32_t capacity, uint32_t generation) {
+  struct CacheIndexHeader *h;
+  struct stat s;
+
+  if(init) {
+    ci->maplen = sizeof(struct CacheIndexHeader) + (size_t) capacity * sizeof(CacheIndexSlot);
+    if(ftruncate(fd, ci->maplen) != 0) {
+      FERROR(errno, "ftruncate()");
+      return -1;
+    }
+  } else {
+    if(fstat(fd, &s) != 0) {
+      FERROR(errno, "fstat()");
+      return -1;
+    }
+    ci->maplen = s.st_size;
+  }
+
+  if(ci->maplen < sizeof(struct CacheIndexHeader)) {
+    FERROR(0, "%s.index is truncated", ci->base);
+    return -1;
+  }
+
+  h = mmap(NULL, ci->maplen, ci->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if(h == MAP_FAILED) {
+    FERROR(errno, "mmap()");
+    return -1;
+  }
+  ci->header = h;
+  ci->slots = (CacheIndexSlot*)(h + 1);
+
+  if(init) {
+    memcpy(h->magic, CACHEINDEX_MAGIC, sizeof(CACHEINDEX_MAGIC));
+    h->capacity = capacity;
+    h->generation = generation;
+  }
+
+  if(memcmp(h->magic, CACHEINDEX_MAGIC, sizeof(CACHEINDEX_MAGIC)) != 0
+      || h->capacity == 0 || (h->capacity & (h->capacity - 1)) != 0
+      || ci->maplen != sizeof(struct CacheIndexHeader) + (size_t) h->capacity * sizeof(CacheIndexSlot)) {
+    FERROR(0, "%s.index is not a cache index", ci->base);
+    munmap(h, ci->maplen);
+    ci->header = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+int cacheindex_open(const char *base, bool writable, CacheIndex *ci) {
+  char path[PATH_MAX];
+  struct stat s;
+
+  memset(ci, 0, sizeof(CacheIndex));
+  ci->lockfd = ci->indexfd = ci->datafd = -1;
+  ci->writable = writable;
+  if(snprintf(ci->base, sizeof(ci->base), "%s", base) >= sizeof(ci->base)) {
+    FERROR(0, "cache index path too long");
+    return -1;
+  }
+
+  /* The index itself is replaced by compaction, so lock something stable */
+  snprintf(path, sizeof(path), "%s.lock", base);
+  if((ci->lockfd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) == -1
+      || flock(ci->lockfd, writable ? LOCK_EX : LOCK_SH) != 0) {
+    FERROR(errno, "%s", path);
+    goto return_error;
+  }
+
+  snprintf(path, sizeof(path), "%s.index", base);
+  if((ci->indexfd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, S_IRUSR | S_IWUSR)) == -1
+      || fstat(ci->indexfd, &s) != 0) {
+    FERROR(errno, "open(%s)", path);
+    goto return_error;
+  }
+
+  if(s.st_size == 0 && writable) {
+    if(map_index(ci, ci->indexfd, true, CAPACITY_MIN, 0) != 0
+        || sync_range(ci->header, ci->maplen) != 0)
+      goto return_error;
+  } else if(map_index(ci, ci->indexfd, false, 0, 0) != 0)
+    goto return_error;
+
+  if(open_data(ci, ci->header->generation, writable ? O_RDWR | O_CREAT | O_APPEND : O_RDONLY) != 0)
+    goto return_error;
+
+  return 0;
+
+return_error:
+  cacheindex_close(ci);
+  return -1;
+}
+
+void cacheindex_close(CacheIndex *ci) {
+  if(ci->header != NULL)
+    munmap(ci->header, ci->maplen);
+  if(ci->datafd != -1)
+    close(ci->datafd);
+  if(ci->indexfd != -1)
+    close(ci->indexfd);
+  if(ci->lockfd != -1)
+    close(ci->lockfd);
+  ci->header = NULL;
+  ci->slots = NULL;
+  ci->lockfd = ci->indexfd = ci->datafd = -1;
+}
+
+void cacheindex_scan(const CacheIndex *ci, uint64_t bucket, CacheIndexVisit visit, void *arg) {
+  const uint32_t capacity = ci->header->capacity;
+  uint32_t i = hash(bucket) & (capacity - 1);
+
+  for(uint32_t n = 0; n < capacity; n++, i = (i + 1) & (capacity - 1)) {
+    const int st = slot_state(&ci->slots[i]);
+    if(st == SLOT_EMPTY)
+      break;
+    if(st == SLOT_USED && ci->slots[i].bucket == bucket)
+      visit(&ci->slots[i], arg);
+  }
+}
+
+int cacheindex_read(const CacheIndex *ci, const CacheIndexSlot *s, Data *d) {
+  d->data = malloc(s->size + 1);
+  GUARD_ALLOC(d->data, -1);
+
+  if(pread(ci->datafd, d->data, s->size, s->offset) != s->size
+      || crc32(0, (const Bytef*) d->data, s->size) != s->datacrc) {
+    FERROR(0, "corrupt cache entry %s", s->key);
+    free(d->data);
+    *d = (Data) DATA_NULL;
+    return -1;
+  }
+
+  d->data[s->size] = '\0';
+  d->datalen = s->size;
+
+  return 0;
+}
+
+int cacheindex_put(CacheIndex *ci, uint64_t bucket, const char *key, double latitude,
+    double longitude, time_t fetched, const Data *d) {
+  struct CacheIndexHeader *h = ci->header;
+  CacheIndexSlot slot;
+  struct stat s;
+  bool existing;
+  uint32_t i;
+
+  if(strlen(key) >= CACHEINDEX_KEY_MAX) {
+    FERROR(0, "cache key too long: %s", key);
+    return -1;
+  }
+
+  /* The payload has to be on disk before any slot refers to it */
+  if(fstat(ci->datafd, &s) != 0
+      || write(ci->datafd, d->data, d->datalen) != d->datalen
+      || fdatasync(ci->datafd) != 0) {
+    FERROR(errno, "%s.data.%u", ci->base, h->generation);
+    return -1;
+  }
+
+  memset(&slot, 0, sizeof(slot));
+  slot.bucket = bucket;
+  strcpy(slot.key, key);
+  slot.latitude = latitude;
+  slot.longitude = longitude;
+  slot.fetched = fetched;
+  slot.offset = s.st_size;
+  slot.size = d->datalen;
+  slot.datacrc = crc32(0, (const Bytef*) d->data, d->datalen);
+  slot.state = SLOT_USED;
+  slot.crc = slot_crc(&slot);
+
+  i = slot_find(ci->slots, h->capacity, bucket, key, &existing);
+  if(existing)
+    h->live -= ci->slots[i].size;
+  else {
+    if(slot_state(&ci->slots[i]) == SLOT_DELETED && h->deleted > 0)
+      h->deleted--;
+    h->used++;
+  }
+  h->live += slot.size;
+
+  memcpy(&ci->slots[i], &slot, sizeof(slot));
+
+  /* The header counters are only used to decide when to compact, so
+   * losing them in a crash costs nothing */
+  return sync_range(&ci->slots[i], sizeof(slot));
+}
+
+/* Deletes the entry s was read from, unless it was replaced since. The
+ * slot stays part of its probe sequence and the payload in the data
+ * file until the next compaction; a slot torn while being deleted reads
+ * as deleted too. */
+int cacheindex_delete(CacheIndex *ci, const CacheIndexSlot *s) {
+  struct CacheIndexHeader *h = ci->header;
+  CacheIndexSlot *slot;
+  bool existing;
+
+  if(ci->writable == false) {
+    FERROR(0, "%s.index is open read-only", ci->base);
+    return -1;
+  }
+
+  slot = &ci->slots[slot_find(ci->slots, h->capacity, s->bucket, s->key, &existing)];
+  if(existing == false || slot->offset != s->offset)
+    return 0;
+
+  h->live -= slot->size;
+  h->used--;
+  h->deleted++;
+  slot->state = SLOT_DELETED;
+  slot->crc = slot_crc(slot);
+
+  return sync_range(slot, sizeof(*slot));
+}
+
+/* Whether the table is too full or the data file too wasteful */
+bool cacheindex_needs_compaction(const CacheIndex *ci) {
+  const struct CacheIndexHeader *h = ci->header;
+  struct stat s;
+
+  if((uint64_t)(h->used + h->deleted + 1) * 10 > (uint64_t) h->capacity * 7)
+    return true;
+  return fstat(ci->datafd, &s) == 0 && s.st_size > 2 * h->live + GARBAGE_MIN;
+}
+
+/* Rewrites the index and data file without deleted entries and those
+ * fetched before oldest. The new index is sized for a load factor of at
+ * most 35%. */
+int cacheindex_compact(CacheIndex *ci, time_t oldest) {
+  const struct CacheIndexHeader *h = ci->header;
+  const uint32_t generation = h->generation + 1;
+  CacheIndex next = *ci;
+  char path[PATH_MAX], tmppath[PATH_MAX];
+  uint32_t live = 0, capacity = CAPACITY_MIN;
+  uint64_t offset = 0;
+  int fd;
+
+  for(uint32_t i = 0; i < h->capacity; i++)
+    if(slot_state(&ci->slots[i]) == SLOT_USED && ci->slots[i].fetched >= oldest)
+      live++;
+  while((uint64_t) capacity * 35 < (uint64_t) live * 100)
+    capacity *= 2;
+
+  snprintf(tmppath, sizeof(tmppath), "%s.index.tmp", ci->base);
+  if((fd = open(tmppath, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR)) == -1) {
+    FERROR(errno, "open(%s)", tmppath);
+    return -1;
+  }
+  next.header = NULL;
+  next.datafd = -1;
+  if(map_index(&next, fd, true, capacity, generation) != 0
+      || open_data(&next, generation, O_RDWR | O_CREAT | O_TRUNC | O_APPEND) != 0)
+    goto return_error;
+
+  for(uint32_t i = 0; i < h->capacity; i++) {
+    const CacheIndexSlot *s = &ci->slots[i];
+    Data d = DATA_NULL;
+    bool existing;
+    uint32_t j;
+
+    if(slot_state(s) != SLOT_USED || s->fetched < oldest)
+      continue;
+    /* Entries that fail to read are dropped */
+    if(cacheindex_read(ci, s, &d) != 0)
+      continue;
+    if(write(next.datafd, d.data, d.datalen) != d.datalen) {
+      FERROR(errno, "write(%s.data.%u)", ci->base, generation);
+      free(d.data);
+      goto return_error;
+    }
+    free(d.data);
+
+    j = slot_find(next.slots, capacity, s->bucket, s->key, &existing);
+    next.slots[j] = *s;
+    next.slots[j].offset = offset;
+    next.slots[j].crc = slot_crc(&next.slots[j]);
+    offset += s->size;
+    next.header->used++;
+    next.header->live += s->size;
+  }
+
+  snprintf(path, sizeof(path), "%s.index", ci->base);
+  if(fdatasync(next.datafd) != 0 || sync_range(next.header, next.maplen) != 0
+      || fsync(fd) != 0 || rename(tmppath, path) != 0) {
+    FERROR(errno, "%s", path);
+    goto return_error;
+  }
+
+  /* Committed: retire the old generation */
+  snprintf(path, sizeof(path), "%s.data.%u", ci->base, h->generation);
+  unlink(path);
+  munmap(ci->header, ci->maplen);
+  close(ci->datafd);
+  close(ci->indexfd);
+  next.indexfd = fd;
+  *ci = next;
+
+  return 0;
+
+return_error:
+  if(next.header != NULL)
+    munmap(next.header, next.maplen);
+  if(next.datafd != -1) {
+    close(next.datafd);
+    snprintf(path, sizeof(path), "%s.data.%u", ci->base, generation);
+    unlink(path);
+  }
+  close(fd);
+  unlink(tmppath);
+  return -1;
+}
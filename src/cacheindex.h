@@ -0,0 +1,81 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CACHEINDEX_H
+#define CACHEINDEX_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "forecast.h"
+
+/* On-disk hash table of cached forecasts. <base>.index is an open
+ * addressing table with linear probing that is memory-mapped, so a
+ * lookup touches a handful of slots no matter how many entries there
+ * are; the payloads are appended to <base>.data.<generation>.
+ *
+ * Entries are grouped by a bucket (e.g. a grid cell) which determines
+ * their home slot; all entries of a bucket are found by scanning its
+ * probe sequence. Every slot carries a checksum, so a slot torn by a
+ * crash reads as deleted rather than pointing at garbage, and payloads
+ * are written and synced before the slot referencing them. Deleting an
+ * entry only marks its slot; compaction writes a new table and data
+ * file without the deleted entries and renames the table into place.
+ * Concurrent processes are serialized by a lock on <base>.lock. */
+
+#define CACHEINDEX_KEY_MAX 40
+
+typedef struct {
+  uint64_t bucket;
+  char key[CACHEINDEX_KEY_MAX];
+  double latitude;
+  double longitude;
+  int64_t fetched;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t datacrc;
+  uint32_t state;
+  uint32_t crc;       /* of all of the above */
+} CacheIndexSlot;
+
+typedef struct {
+  char base[PATH_MAX - 16];
+  int lockfd;
+  int indexfd;
+  int datafd;
+  bool writable;
+  struct CacheIndexHeader *header;
+  CacheIndexSlot *slots;
+  size_t maplen;
+} CacheIndex;
+
+typedef void (*CacheIndexVisit)(const CacheIndexSlot *s, void *arg);
+
+int   cacheindex_open(const char *base, bool writable, CacheIndex *ci);
+void  cacheindex_close(CacheIndex *ci);
+void  cacheindex_scan(const CacheIndex *ci, uint64_t bucket, CacheIndexVisit visit, void *arg);
+int   cacheindex_read(const CacheIndex *ci, const CacheIndexSlot *s, Data *d);
+int   cacheindex_put(CacheIndex *ci, uint64_t bucket, const char *key, double latitude,
+        double longitude, time_t fetched, const Data *d);
+int   cacheindex_delete(CacheIndex *ci, const CacheIndexSlot *s);
+bool  cacheindex_needs_compaction(const CacheIndex *ci);
+int   cacheindex_compact(CacheIndex *ci, time_t oldest);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "codec.h"
+
+#define GZIP_WINDOW (15 + 16)
+#define CHUNK       (64 * 1024)
+/* deflate can't do better than about 1:1032 */
+#define RATIO_MAX   1032
+
+static int append(const char *buf, size_t len, void *arg);
+
+/* Serializes d into a gzip compressed entry, header included */
+int codec_pack(const Data *d, Data *entry) {
+  const uint64_t rawlen = d->datalen;
+  z_stream z = { 0 };
+  size_t bound;
+
+  if(d->codec != CODEC_NONE) {
+    FERROR(0, "data is compressed already");
+    return -1;
+  }
+
+  if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    FERROR(0, "deflateInit2(): %s", z.msg ?: "failed");
+    return -1;
+  }
+
+  bound = CODEC_HEADER_LEN + deflateBound(&z, d->datalen);
+  if((entry->data = malloc(bound)) == NULL) {
+    FERROR(errno, "malloc()");
+    deflateEnd(&z);
+    return -1;
+  }
+
+  memset(entry->data, 0, CODEC_HEADER_LEN);
+  memcpy(entry->data, CODEC_MAGIC, 4);
+  entry->data[4] = CODEC_GZIP;
+  memcpy(&entry->data[8], &rawlen, sizeof(rawlen));
+
+  z.next_in = (Bytef*) d->data;
+  z.avail_in = d->datalen;
+  z.next_out = (Bytef*) &entry->data[CODEC_HEADER_LEN];
+  z.avail_out = bound - CODEC_HEADER_LEN;
+  if(deflate(&z, Z_FINISH) != Z_STREAM_END) {
+    FERROR(0, "deflate(): %s", z.msg ?: "failed");
+    deflateEnd(&z);
+    free(entry->data);
+    entry->data = NULL;
+    return -1;
+  }
+
+  entry->datalen = CODEC_HEADER_LEN + z.total_out;
+  entry->codec = CODEC_NONE;    /* it's a serialized entry, not a payload */
+  entry->rawlen = entry->datalen;
+  deflateEnd(&z);
+
+  return 0;
+}
+
+/* Interprets freshly read entry bytes: strips the header, if any, and
+ * records the codec */
+int codec_unpack(Data *d) {
+  uint64_t rawlen;
+
+  if(d->datalen < CODEC_HEADER_LEN || memcmp(d->data, CODEC_MAGIC, 4) != 0) {
+    d->codec = CODEC_NONE;
+    d->rawlen = d->datalen;
+    return 0;
+  }
+
+  if(d->data[4] != CODEC_GZIP) {
+    FERROR(0, "unknown codec %d", d->data[4]);
+    return -1;
+  }
+
+  memcpy(&rawlen, &d->data[8], sizeof(rawlen));
+  if(rawlen > (uint64_t)(d->datalen - CODEC_HEADER_LEN) * RATIO_MAX) {
+    FERROR(0, "corrupt compressed entry");
+    return -1;
+  }
+  d->codec = d->data[4];
+  d->rawlen = rawlen;
+  d->datalen -= CODEC_HEADER_LEN;
+  memmove(d->data, &d->data[CODEC_HEADER_LEN], d->datalen);
+
+  return 0;
+}
+
+int codec_stream(const Data *d, CodecSink sink, void *arg) {
+  char buf[CHUNK];
+  z_stream z = { 0 };
+  int r, ret = 0;
+
+  if(d->codec == CODEC_NONE)
+    return sink(d->data, d->datalen, arg) < 0 ? -1 : 0;
+
+  if(inflateInit2(&z, GZIP_WINDOW) != Z_OK) {
+    FERROR(0, "inflateInit2(): %s", z.msg ?: "failed");
+    return -1;
+  }
+
+  z.next_in = (Bytef*) d->data;
+  z.avail_in = d->datalen;
+
+  do {
+    z.next_out = (Bytef*) buf;
+    z.avail_out = sizeof(buf);
+    r = inflate(&z, Z_NO_FLUSH);
+    if(r != Z_OK && r != Z_STREAM_END) {
+      FERROR(0, "corrupt compressed data: %s", z.msg ?: zError(r));
+      ret = -1;
+      break;
+    }
+    if((ret = sink(buf, sizeof(buf) - z.avail_out, arg)) != 0) {
+      ret = ret < 0 ? -1 : 0;
+      break;
+    }
+  } while(r != Z_STREAM_END);
+
+  inflateEnd(&z);
+
+  return ret;
+}
+
+int append(const char *buf, size_t len, void *arg) {
+  Data *raw = (Data*) arg;
+
+  if(raw->datalen + len > raw->rawlen) {
+    FERROR(0, "decompressed data exceeds its recorded length");
+    return -1;
+  }
+  memcpy(&raw->data[raw->datalen], buf, len);
+  raw->datalen += len;
+
+  return 0;
+}
+
+/* Replaces compressed data with the NUL terminated JSON it holds */
+int codec_decompress(Data *d) {
+  Data raw = *d;
+
+  if(d->codec == CODEC_NONE)
+    return 0;
+
+  raw.datalen = 0;
+  raw.codec = CODEC_NONE;
+  if((raw.data = malloc(d->rawlen + 1)) == NULL) {
+    FERROR(errno, "malloc()");
+    return -1;
+  }
+
+  if(codec_stream(d, append, &raw) != 0) {
+    free(raw.data);
+    return -1;
+  }
+  raw.data[raw.datalen] = '\0';
+  raw.rawlen = raw.datalen;
+
+  free(d->data);
+  *d = raw;
+
+  return 0;
+}
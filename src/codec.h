@@ -0,0 +1,43 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+
+#include "forecast.h"
+
+/* Compressed cache entries start with this header followed by the
+ * payload; entries without it are plain JSON, as written by older
+ * versions. CODEC_GZIP payloads are gzip streams, so
+ * `tail -c +17 ENTRY | zcat` recovers the JSON. */
+
+#define CODEC_MAGIC       "FCC1"
+#define CODEC_HEADER_LEN  16
+
+/* Receives the decompressed data in pieces; a negative return value
+ * aborts the stream, a positive one ends it early */
+typedef int (*CodecSink)(const char *buf, size_t len, void *arg);
+
+int codec_pack(const Data *d, Data *entry);
+int codec_unpack(Data *d);
+int codec_decompress(Data *d);
+int codec_stream(const Data *d, CodecSink sink, void *arg);
+
+#endif
@@ -16,7 +16,354 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
 #include "configfile.h"
+#include "parse.h"
+
+static const char *location_blocks[] = {
+  "currently", "minutely", "hourly", "daily", "alerts", "flags", NULL
+};
+
+/* What -m diff reports unless configured otherwise. The API reports
+ * in °F by default, so 3.6 is a shift of 2 °C */
+static const struct {
+  const char *field;
+  int kind;
+  double value;
+} diff_defaults[] = {
+  { "precipProbability", DIFF_THRESHOLD, 0.5 },
+  { "temperature",       DIFF_DELTA,     3.6 },
+  { "temperatureMin",    DIFF_DELTA,     3.6 },
+  { "temperatureMax",    DIFF_DELTA,     3.6 }
+};
+
+static const struct {
+  const char *op;
+  int cmp;
+} alert_cmps[] = {
+  { "<",  ALERT_LT }, { "<=", ALERT_LE }, { ">",  ALERT_GT },
+  { ">=", ALERT_GE }, { "==", ALERT_EQ }, { "!=", ALERT_NE }
+};
+
+static int    match_cache_expiry(const char *str);
+static int    match_plot_aggregate(const char *str);
+static int    location_exclude(Config *c, const config_setting_t *blocks, char **exclude);
+static int    load_location(const config_setting_t *s, Config *c, Location *l);
+static int    load_locations(const config_t *cfg, Config *c);
+static int    load_diff_rules(const config_t *cfg, Config *c);
+static int    load_alert_rule(const config_setting_t *s, Config *c, AlertRule *r);
+static int    load_alert_rules(const config_t *cfg, Config *c);
+static int    load_hourly_fields(const config_t *cfg, Config *c);
+
+int match_cache_expiry(const char *str) {
+  if(strcmp(str, "age") == 0)
+    return CACHE_EXPIRY_AGE;
+  else if(strcmp(str, "data") == 0)
+    return CACHE_EXPIRY_DATA;
+  else
+    return -1;
+}
+
+int match_plot_aggregate(const char *str) {
+  if(strcmp(str, "max") == 0)
+    return PLOT_AGGREGATE_MAX;
+  else if(strcmp(str, "mean") == 0)
+    return PLOT_AGGREGATE_MEAN;
+  else if(strcmp(str, "min") == 0)
+    return PLOT_AGGREGATE_MIN;
+  else
+    return -1;
+}
+
+/* Translates the list of wanted data blocks into the complementing
+ * exclude= list the forecast.io API expects */
+int location_exclude(Config *c, const config_setting_t *blocks, char **exclude) {
+  char buf[128] = "";
+  const int blen = config_setting_length(blocks);
+
+  for(int i = 0; i < blen; i++) {
+    const char *b = config_setting_get_string_elem(blocks, i);
+    int known = 0;
+    for(const char **k = location_blocks; *k != NULL; k++)
+      if(b != NULL && strcmp(b, *k) == 0)
+        known = 1;
+    if(known == 0) {
+      FERROR(0, "[blocks] unknown data block: %s", b ? b : "(not a string)");
+      return -1;
+    }
+  }
+
+  for(const char **k = location_blocks; *k != NULL; k++) {
+    int wanted = 0;
+    for(int i = 0; i < blen; i++)
+      if(strcmp(config_setting_get_string_elem(blocks, i), *k) == 0)
+        wanted = 1;
+    if(wanted == 0) {
+      if(buf[0] != '\0')
+        strcat(buf, ",");
+      strcat(buf, *k);
+    }
+  }
+
+  if(buf[0] == '\0')
+    return 0;
+  *exclude = arena_strdup(&c->arena, buf);
+  return *exclude == NULL ? -1 : 0;
+}
+
+int load_location(const config_setting_t *s, Config *c, Location *l) {
+  const char *tmp;
+  const config_setting_t *blocks;
+  int compress;
+
+  if(config_setting_lookup_string(s, "name", &tmp) == CONFIG_TRUE)
+    if((l->name = arena_strdup(&c->arena, tmp)) == NULL)
+      return -1;
+
+  if(config_setting_lookup_float(s, "latitude", &l->latitude) != CONFIG_TRUE
+      || config_setting_lookup_float(s, "longitude", &l->longitude) != CONFIG_TRUE) {
+    FERROR(0, "[location %s] latitude and longitude must be configured",
+        l->name ? l->name : "");
+    return -1;
+  }
+
+  if(config_setting_lookup_int(s, "max_cache_age", &l->max_cache_age) != CONFIG_TRUE)
+    l->max_cache_age = c->max_cache_age;
+
+  l->cache_expiry = c->cache_expiry;
+  if(config_setting_lookup_string(s, "cache_expiry", &tmp) == CONFIG_TRUE
+      && (l->cache_expiry = match_cache_expiry(tmp)) == -1) {
+    FERROR(0, "[location %s] unknown cache_expiry: %s", l->name ? l->name : "", tmp);
+    return -1;
+  }
+  if(config_setting_lookup_int(s, "max_data_age", &l->max_data_age) != CONFIG_TRUE)
+    l->max_data_age = c->max_data_age;
+
+  l->compress = config_setting_lookup_bool(s, "cache_compress", &compress) == CONFIG_TRUE ?
+    compress : c->cache_compress;
+
+  /* Named locations get their own cache file next to the global one
+   * unless configured otherwise */
+  if(config_setting_lookup_string(s, "cache_file", &tmp) == CONFIG_TRUE)
+    l->cache_file = arena_strdup(&c->arena, tmp);
+  else if(l->name != NULL)
+    l->cache_file = arena_printf(&c->arena, "%s.%s", c->cache_file, l->name);
+  else
+    l->cache_file = c->cache_file;
+  if(l->cache_file == NULL)
+    return -1;
+
+  if((blocks = config_setting_get_member(s, "blocks")) != NULL)
+    if(location_exclude(c, blocks, &l->exclude) != 0)
+      return -1;
+
+  return 0;
+}
+
+int load_locations(const config_t *cfg, Config *c) {
+  const config_setting_t *s;
+
+  if((s = config_lookup(cfg, "locations")) != NULL) {
+    c->locations_len = config_setting_length(s);
+    if(c->locations_len == 0) {
+      FERROR(0, "[locations] must not be empty");
+      return -1;
+    }
+    if((c->locations = arena_calloc(&c->arena, c->locations_len, sizeof(Location))) == NULL)
+      return -1;
+    for(int i = 0; i < c->locations_len; i++) {
+      const config_setting_t *e = config_setting_get_elem(s, i);
+      if(load_location(e, c, &c->locations[i]) != 0)
+        return -1;
+      if(c->locations[i].name == NULL) {
+        FERROR(0, "[locations] entry %d has no name", i);
+        return -1;
+      }
+      for(int j = 0; j < i; j++)
+        if(strcmp(c->locations[i].name, c->locations[j].name) == 0) {
+          FERROR(0, "[locations] duplicate name: %s", c->locations[i].name);
+          return -1;
+        }
+    }
+  } else if((s = config_lookup(cfg, "location")) != NULL) {
+    /* Single unnamed location, the original configuration format */
+    c->locations_len = 1;
+    if((c->locations = arena_calloc(&c->arena, 1, sizeof(Location))) == NULL)
+      return -1;
+    if(load_location(s, c, &c->locations[0]) != 0)
+      return -1;
+  } else {
+    FERROR(0, "[locations] not configured");
+    return -1;
+  }
+
+  c->location = &c->locations[0];
+
+  return 0;
+}
+
+/* The temperature fields plot-hourly draws over each other */
+int load_hourly_fields(const config_t *cfg, Config *c) {
+  static const char *temperatures[] = { "temperature", "apparentTemperature", "dewPoint" };
+  const config_setting_t *s = config_lookup(cfg, "plot.hourly.fields");
+  const char *tmp;
+
+  if(s == NULL)
+    return 0;
+
+  c->plot.hourly.fields_len = config_setting_length(s);
+  if(c->plot.hourly.fields_len > PLOT_OVERLAY_MAX) {
+    FERROR(0, "[plot.hourly.fields] has more than %d fields", PLOT_OVERLAY_MAX);
+    return -1;
+  }
+
+  for(int i = 0; i < c->plot.hourly.fields_len; i++) {
+    int j = 0;
+
+    if((tmp = config_setting_get_string_elem(s, i)) != NULL)
+      while(j < sizeof(temperatures)/sizeof(temperatures[0])
+          && strcmp(temperatures[j], tmp) != 0)
+        j++;
+    if(tmp == NULL || j == sizeof(temperatures)/sizeof(temperatures[0])) {
+      FERROR(0, "[plot.hourly.fields] must be temperature, apparentTemperature or dewPoint");
+      return -1;
+    }
+    c->plot.hourly.fields[i] = datapoint_field(tmp) - datapoint_fields;
+  }
+
+  return 0;
+}
+
+int load_diff_rules(const config_t *cfg, Config *c) {
+  const config_setting_t *s = config_lookup(cfg, "diff");
+  const DatapointField *field;
+  const char *tmp;
+
+  if(s == NULL) {
+    c->diff_rules_len = sizeof(diff_defaults)/sizeof(diff_defaults[0]);
+    if((c->diff_rules = arena_calloc(&c->arena, c->diff_rules_len, sizeof(DiffRule))) == NULL)
+      return -1;
+    for(int i = 0; i < c->diff_rules_len; i++) {
+      c->diff_rules[i].field = datapoint_field(diff_defaults[i].field) - datapoint_fields;
+      c->diff_rules[i].kind = diff_defaults[i].kind;
+      c->diff_rules[i].value = diff_defaults[i].value;
+    }
+    return 0;
+  }
+
+  if((c->diff_rules_len = config_setting_length(s)) == 0)
+    return 0;
+  if((c->diff_rules = arena_calloc(&c->arena, c->diff_rules_len, sizeof(DiffRule))) == NULL)
+    return -1;
+
+  for(int i = 0; i < c->diff_rules_len; i++) {
+    const config_setting_t *e = config_setting_get_elem(s, i);
+    DiffRule *r = &c->diff_rules[i];
+
+    if(config_setting_lookup_string(e, "field", &tmp) != CONFIG_TRUE) {
+      FERROR(0, "[diff] entry %d has no field", i);
+      return -1;
+    }
+    if((field = datapoint_field(tmp)) == NULL || field->type == FIELD_STRING) {
+      FERROR(0, "[diff] not a numeric field: %s", tmp);
+      return -1;
+    }
+    r->field = field - datapoint_fields;
+
+    if(config_setting_lookup_float(e, "threshold", &r->value) == CONFIG_TRUE)
+      r->kind = DIFF_THRESHOLD;
+    else if(config_setting_lookup_float(e, "delta", &r->value) == CONFIG_TRUE)
+      r->kind = DIFF_DELTA;
+    else {
+      FERROR(0, "[diff] entry %d needs a threshold or a delta", i);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int load_alert_rule(const config_setting_t *s, Config *c, AlertRule *r) {
+  const DatapointField *field;
+  const char *tmp;
+  int i;
+
+  if(config_setting_lookup_string(s, "name", &tmp) != CONFIG_TRUE) {
+    FERROR(0, "[alerts] entry without a name");
+    return -1;
+  }
+  if((r->name = arena_strdup(&c->arena, tmp)) == NULL)
+    return -1;
+
+  if(config_setting_lookup_string(s, "block", &tmp) != CONFIG_TRUE
+      || strcmp(tmp, "hourly") == 0)
+    r->block = BLOCK_HOURLY;
+  else if(strcmp(tmp, "daily") == 0)
+    r->block = BLOCK_DAILY;
+  else if(strcmp(tmp, "currently") == 0)
+    r->block = BLOCK_CURRENTLY;
+  else {
+    FERROR(0, "[alerts] %s: unknown block: %s", r->name, tmp);
+    return -1;
+  }
+
+  if(config_setting_lookup_string(s, "field", &tmp) != CONFIG_TRUE
+      || (field = datapoint_field(tmp)) == NULL || field->type == FIELD_STRING) {
+    FERROR(0, "[alerts] %s: missing or non-numeric field", r->name);
+    return -1;
+  }
+  r->field = field - datapoint_fields;
+
+  if(config_setting_lookup_string(s, "op", &tmp) != CONFIG_TRUE)
+    tmp = "";
+  for(i = 0; i < sizeof(alert_cmps)/sizeof(alert_cmps[0]); i++)
+    if(strcmp(alert_cmps[i].op, tmp) == 0)
+      break;
+  if(i == sizeof(alert_cmps)/sizeof(alert_cmps[0])) {
+    FERROR(0, "[alerts] %s: op must be one of <, <=, >, >=, ==, !=", r->name);
+    return -1;
+  }
+  r->cmp = alert_cmps[i].cmp;
+
+  if(config_setting_lookup_float(s, "value", &r->value) != CONFIG_TRUE) {
+    FERROR(0, "[alerts] %s: missing value", r->name);
+    return -1;
+  }
+
+  if(config_setting_lookup_int(s, "within", &r->within) != CONFIG_TRUE)
+    r->within = 0;
+  if(r->within < 0) {
+    FERROR(0, "[alerts] %s: within must not be negative", r->name);
+    return -1;
+  }
+
+  return 0;
+}
+
+int load_alert_rules(const config_t *cfg, Config *c) {
+  const config_setting_t *s;
+
+  if((s = config_lookup(cfg, "alerts")) == NULL)
+    return 0;
+
+  if((c->alert_rules_len = config_setting_length(s)) == 0)
+    return 0;
+  if((c->alert_rules = arena_calloc(&c->arena, c->alert_rules_len, sizeof(AlertRule))) == NULL)
+    return -1;
+
+  for(int i = 0; i < c->alert_rules_len; i++)
+    if(load_alert_rule(config_setting_get_elem(s, i), c, &c->alert_rules[i]) != 0)
+      return -1;
+
+  return 0;
+}
+
+Location* find_location(const Config *c, const char *name) {
+  for(int i = 0; i < c->locations_len; i++)
+    if(c->locations[i].name != NULL && strcmp(c->locations[i].name, name) == 0)
+      return &c->locations[i];
+  return NULL;
+}
 
 int load_config(Config *c) {
   assert(c);
@@ -24,16 +371,17 @@ int load_config(Config *c) {
   config_t cfg;
   const char *apikey;
   const char *tmp;
+  int ival;
 
   if(access(c->path, R_OK) != 0) {
-    LERROR(0, errno, "%s", c->path);
+    FERROR(errno, "%s", c->path);
     return -1;
   }
 
   config_init(&cfg);
 
   if(config_read_file(&cfg, c->path) != CONFIG_TRUE) {
-    LERROR(0, 0, "[%s, %d] %s",
+    FERROR(0, "[%s, %d] %s",
         config_error_file(&cfg),
         config_error_line(&cfg),
         config_error_text(&cfg));
@@ -41,14 +389,13 @@ int load_config(Config *c) {
   }
 
   if(config_lookup_string(&cfg, "apikey", &apikey) != CONFIG_TRUE) {
-    LERROR(0, 0, "No API key found.");
+    FERROR(0, "No API key found.");
     goto return_error;
   }
-  c->apikey = malloc(strlen(apikey) + 1);
-  GUARD_MALLOC(c->apikey);
-  memcpy((void*)c->apikey, apikey, strlen(apikey) + 1);
+  if((c->apikey = arena_strdup(&c->arena, apikey)) == NULL)
+    goto return_error;
 
-#define LOOKUP_LERROR(key) LERROR(0, 0, "[" #key "] not configured");
+#define LOOKUP_LERROR(key) FERROR(0, "[" #key "] not configured");
 #define LOOKUP_GENERIC(func, key)                   \
   if(func(&cfg, #key, &(c->key)) != CONFIG_TRUE) {  \
     LOOKUP_LERROR(key)                              \
@@ -58,9 +405,8 @@ int load_config(Config *c) {
 #define LOOKUP_FLOAT(key) LOOKUP_GENERIC(config_lookup_float, key)
 #define LOOKUP_STRING(key)                                    \
   if(config_lookup_string(&cfg, #key, &tmp) == CONFIG_TRUE) { \
-    c->key = malloc(strlen(tmp)+1);                           \
-    GUARD_MALLOC(c->key);                                     \
-    memcpy(c->key, tmp, strlen(tmp)+1);                       \
+    if((c->key = arena_strdup(&c->arena, tmp)) == NULL)      \
+      goto return_error;                                      \
   } else {                                                    \
     LOOKUP_LERROR(key)                                        \
     goto return_error;                                        \
@@ -75,20 +421,101 @@ int load_config(Config *c) {
 
   /* General */
 
-  LOOKUP_FLOAT(location.latitude);
-  LOOKUP_FLOAT(location.longitude);
-
   LOOKUP_INT(max_cache_age);
 
   LOOKUP_STRING(cache_file);
 
+  if(config_lookup_bool(&cfg, "cache_compress", &ival) == CONFIG_TRUE)
+    c->cache_compress = ival;
+
+  if(config_lookup_string(&cfg, "cache_expiry", &tmp) == CONFIG_TRUE
+      && (c->cache_expiry = match_cache_expiry(tmp)) == -1) {
+    FERROR(0, "[cache_expiry] must be one of age, data");
+    goto return_error;
+  }
+
+  if(config_lookup_int(&cfg, "max_data_age", &c->max_data_age) == CONFIG_TRUE
+      && c->max_data_age < 0) {
+    FERROR(0, "[max_data_age] must not be negative");
+    goto return_error;
+  }
+
+  if(config_lookup_float(&cfg, "cache_tolerance", &c->cache_tolerance) == CONFIG_TRUE
+      && c->cache_tolerance < 0.0) {
+    FERROR(0, "[cache_tolerance] must not be negative");
+    goto return_error;
+  }
+
+  if(config_lookup_bool(&cfg, "cache_stale_fallback", &ival) == CONFIG_TRUE)
+    c->cache_stale_fallback = ival;
+
+  /* The request settings are optional */
+  config_lookup_int(&cfg, "request.connect_timeout", &c->request.connect_timeout);
+  config_lookup_int(&cfg, "request.timeout", &c->request.timeout);
+  config_lookup_int(&cfg, "request.retries", &c->request.retries);
+  config_lookup_int(&cfg, "request.backoff", &c->request.backoff);
+  config_lookup_int(&cfg, "request.hedge_delay", &c->request.hedge_delay);
+  if(c->request.connect_timeout < 0 || c->request.timeout < 0 || c->request.retries < 0
+      || c->request.backoff < 0 || c->request.hedge_delay < 0) {
+    FERROR(0, "[request] settings must not be negative");
+    goto return_error;
+  }
+
+  if(config_lookup_string(&cfg, "api_url", &tmp) == CONFIG_TRUE) {
+    char *url;
+
+    if((url = arena_strdup(&c->arena, tmp)) == NULL)
+      goto return_error;
+    for(size_t i = strlen(url); i > 0 && url[i-1] == '/'; i--)
+      url[i-1] = '\0';
+    c->api_url = url;
+  }
+
+  if(config_lookup_string(&cfg, "metrics_file", &tmp) == CONFIG_TRUE)
+    if((c->metrics_file = arena_strdup(&c->arena, tmp)) == NULL)
+      goto return_error;
+
+  if(config_lookup_string(&cfg, "record_file", &tmp) == CONFIG_TRUE)
+    if((c->record_file = arena_strdup(&c->arena, tmp)) == NULL)
+      goto return_error;
+
+  if(config_lookup_string(&cfg, "replay_file", &tmp) == CONFIG_TRUE)
+    if((c->replay_file = arena_strdup(&c->arena, tmp)) == NULL)
+      goto return_error;
+
+  if(c->record_file != NULL && c->replay_file != NULL) {
+    FERROR(0, "[record_file] and [replay_file] are mutually exclusive");
+    goto return_error;
+  }
+
+  if(config_lookup_bool(&cfg, "replay_timing", &ival) == CONFIG_TRUE)
+    c->replay_timing = ival;
+
+  if(config_lookup_string(&cfg, "history_dir", &tmp) == CONFIG_TRUE)
+    if((c->history_dir = arena_strdup(&c->arena, tmp)) == NULL)
+      goto return_error;
+
+  if(config_lookup_bool(&cfg, "history_compress", &ival) == CONFIG_TRUE)
+    c->history_compress = ival;
+
+  if(load_locations(&cfg, c) != 0)
+    goto return_error;
+
+  if(load_diff_rules(&cfg, c) != 0)
+    goto return_error;
+
+  if(load_alert_rules(&cfg, c) != 0)
+    goto return_error;
+
   if(config_lookup_string(&cfg, "op", &tmp) != CONFIG_TRUE) {
     LOOKUP_LERROR(op);
     goto return_error;
   } else {
     c->op = match_mode_arg(tmp);
-    if(c->op == -1)
+    if(c->op == -1) {
+      FERROR(0, "[op] invalid mode: %s", tmp);
       goto return_error;
+    }
   }
 
   /* Plot */
@@ -112,6 +539,24 @@ int load_config(Config *c) {
   LOOKUP_STRING(plot.daylight.time_label_format);
   LOOKUP_STRING(plot.hourly.label_format);
 
+  /* Optional, unlike the settings above */
+  if(config_lookup_string(&cfg, "plot.minutely.label_format", &tmp) == CONFIG_TRUE)
+    if((c->plot.minutely.label_format = arena_strdup(&c->arena, tmp)) == NULL)
+      goto return_error;
+
+  if(config_lookup_string(&cfg, "plot.bar.overlay2_color", &tmp) == CONFIG_TRUE) {
+    CHECKCOLORS(c->plot.bar.overlay2_color)
+  }
+
+  if(load_hourly_fields(&cfg, c) != 0)
+    goto return_error;
+
+  if(config_lookup_string(&cfg, "plot.minutely.aggregate", &tmp) == CONFIG_TRUE
+      && (c->plot.minutely.aggregate = match_plot_aggregate(tmp)) == -1) {
+    FERROR(0, "[plot.minutely.aggregate] must be one of max, mean, min");
+    goto return_error;
+  }
+
 #undef LOOKUP_COLOR
 #undef LOOKUP_INT
 #undef LOOKUP_FLOAT
@@ -127,15 +572,10 @@ return_error:
   return -1;
 }
 
+/* c->path may point elsewhere, e.g. to a command line argument */
 void free_config(Config *c) {
-#define FREE_KEY(key) \
-  if((key) != NULL) free(key)
-  FREE_KEY(c->path);
-  FREE_KEY(c->plot.daily.label_format);
-  FREE_KEY(c->plot.hourly.label_format);
-  FREE_KEY((void*)c->apikey);
-  FREE_KEY((void*)c->cache_file);
-#undef FREE_KEY
+  arena_free(&c->arena);
+  *c = (Config) CONFIG_NULL;
 }
 
 int match_mode_arg(const char *str) {
@@ -151,8 +591,14 @@ int match_mode_arg(const char *str) {
     return OP_PLOT_PRECIPITATION_DAILY;
   else if(strcmp(str, "plot-precip-hourly") == 0)
     return OP_PLOT_PRECIPITATION_HOURLY;
+  else if(strcmp(str, "plot-precip-minutely") == 0)
+    return OP_PLOT_PRECIPITATION_MINUTELY;
   else if(strcmp(str, "plot-daylight") == 0)
     return OP_PLOT_DAYLIGHT;
+  else if(strcmp(str, "diff") == 0)
+    return OP_DIFF;
+  else if(strcmp(str, "alert") == 0)
+    return OP_ALERT;
   else
     return -1;
 }
@@ -164,20 +610,13 @@ int string_isalnum(const char *s) {
   return 0;
 }
 
-void set_config_path(Config *c) {
-  int plen;
+int set_config_path(Config *c) {
+  const char *p = getenv("FORECAST_CONFIG_PATH");
 
-  if(getenv("FORECAST_CONFIG_PATH") == NULL) {
-    plen = snprintf(NULL, 0, "%s/%s", getenv("HOME"), RCNAME) + 1;
-    c->path = malloc(plen);
-    GUARD_MALLOC(c->path);
-    snprintf((char*)c->path, plen, "%s/%s", getenv("HOME"), RCNAME);
-  } else {
-    char *p = getenv("FORECAST_CONFIG_PATH");
-    plen = strlen(p)+1;
-    c->path = malloc(plen);
-    GUARD_MALLOC(c->path);
-    memcpy(c->path, p, plen);
-  }
+  if(p == NULL)
+    c->path = arena_printf(&c->arena, "%s/%s", getenv("HOME"), RCNAME);
+  else
+    c->path = arena_strdup(&c->arena, p);
 
+  return c->path == NULL ? -1 : 0;
 }
@@ -38,9 +38,10 @@
     else CHECKCOLOR(var, CYAN)       \
     else CHECKCOLOR(var, WHITE)
 
-void set_config_path(Config *c);
+int set_config_path(Config *c);
 int load_config(Config *c);
 void free_config(Config *c);
+Location* find_location(const Config *c, const char *name);
 int match_mode_arg(const char *str);
 int string_isalnum(const char *str);
 
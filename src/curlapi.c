@@ -0,0 +1,123 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "config.h"
+
+#ifdef ENABLE_DLOPEN
+#include <dlfcn.h>
+#endif
+
+#include "curlapi.h"
+
+static CurlApi api;
+static const CurlApi *loaded = NULL;
+static char load_error[FORECAST_ERROR_MAX] = "libcurl was unloaded";
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+#ifdef ENABLE_DLOPEN
+static void *handle = NULL;
+#endif
+
+static void curlapi_init(void);
+
+void curlapi_init(void) {
+  CURLcode r;
+
+#ifdef ENABLE_DLOPEN
+#define SYMBOL(f) { "curl_" #f, (void**) &api.f }
+  const struct {
+    const char *name;
+    void **fn;
+  } symbols[] = {
+    SYMBOL(global_init),
+    SYMBOL(global_cleanup),
+    SYMBOL(easy_init),
+    SYMBOL(easy_setopt),
+    SYMBOL(easy_getinfo),
+    SYMBOL(easy_cleanup),
+    SYMBOL(easy_strerror),
+    SYMBOL(multi_init),
+    SYMBOL(multi_add_handle),
+    SYMBOL(multi_remove_handle),
+    SYMBOL(multi_perform),
+    SYMBOL(multi_wait),
+    SYMBOL(multi_info_read),
+    SYMBOL(multi_cleanup)
+  };
+#undef SYMBOL
+
+  if((handle = dlopen(CURLAPI_SONAME, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+    snprintf(load_error, sizeof(load_error), "dlopen(%s): %s", CURLAPI_SONAME, dlerror());
+    return;
+  }
+  for(int i = 0; i < sizeof(symbols)/sizeof(symbols[0]); i++)
+    if((*symbols[i].fn = dlsym(handle, symbols[i].name)) == NULL) {
+      snprintf(load_error, sizeof(load_error), "dlsym(%s): %s", symbols[i].name, dlerror());
+      dlclose(handle);
+      handle = NULL;
+      return;
+    }
+#else
+  api = (CurlApi) {
+    .global_init          = curl_global_init,
+    .global_cleanup       = curl_global_cleanup,
+    .easy_init            = curl_easy_init,
+    .easy_setopt          = curl_easy_setopt,
+    .easy_getinfo         = curl_easy_getinfo,
+    .easy_cleanup         = curl_easy_cleanup,
+    .easy_strerror        = curl_easy_strerror,
+    .multi_init           = curl_multi_init,
+    .multi_add_handle     = curl_multi_add_handle,
+    .multi_remove_handle  = curl_multi_remove_handle,
+    .multi_perform        = curl_multi_perform,
+    .multi_wait           = curl_multi_wait,
+    .multi_info_read      = curl_multi_info_read,
+    .multi_cleanup        = curl_multi_cleanup
+  };
+#endif
+
+  if((r = api.global_init(CURL_GLOBAL_DEFAULT)) != CURLE_OK) {
+    snprintf(load_error, sizeof(load_error), "curl_global_init(): %s", api.easy_strerror(r));
+    return;
+  }
+
+  loaded = &api;
+}
+
+/* Loads and initializes libcurl on the first call; thread safe */
+const CurlApi* curlapi_load(void) {
+  pthread_once(&once, curlapi_init);
+  if(loaded == NULL)
+    FERROR(0, "%s", load_error);
+  return loaded;
+}
+
+/* At exit only, libcurl can't be loaded again afterwards. Does nothing
+ * if it never was loaded. */
+void curlapi_unload(void) {
+  if(loaded == NULL)
+    return;
+  loaded->global_cleanup();
+  loaded = NULL;
+#ifdef ENABLE_DLOPEN
+  dlclose(handle);
+  handle = NULL;
+#endif
+}
@@ -0,0 +1,58 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CURLAPI_H
+#define CURLAPI_H
+
+#include <curl/curl.h>
+
+#include "forecast.h"
+
+/* The libcurl functions forecast uses, called through a table. Unless
+ * configured with --disable-dlopen, libcurl isn't linked but loaded
+ * when the first request is made: loading it and its dependencies
+ * takes the dynamic linker longer than serving a forecast from the
+ * cache takes altogether. curl_global_init() runs at the same time, so
+ * neither is paid for by invocations that don't make requests. */
+
+#ifndef CURLAPI_SONAME
+#define CURLAPI_SONAME "libcurl.so.4"
+#endif
+
+typedef struct {
+  CURLcode    (*global_init)(long flags);
+  void        (*global_cleanup)(void);
+  CURL*       (*easy_init)(void);
+  CURLcode    (*easy_setopt)(CURL *curl, CURLoption option, ...);
+  CURLcode    (*easy_getinfo)(CURL *curl, CURLINFO info, ...);
+  void        (*easy_cleanup)(CURL *curl);
+  const char* (*easy_strerror)(CURLcode r);
+  CURLM*      (*multi_init)(void);
+  CURLMcode   (*multi_add_handle)(CURLM *multi, CURL *curl);
+  CURLMcode   (*multi_remove_handle)(CURLM *multi, CURL *curl);
+  CURLMcode   (*multi_perform)(CURLM *multi, int *running);
+  CURLMcode   (*multi_wait)(CURLM *multi, struct curl_waitfd *fds, unsigned int nfds,
+                int timeout, int *numfds);
+  CURLMsg*    (*multi_info_read)(CURLM *multi, int *queued);
+  CURLMcode   (*multi_cleanup)(CURLM *multi);
+} CurlApi;
+
+const CurlApi*  curlapi_load(void);
+void            curlapi_unload(void);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+
+#include "diff.h"
+#include "parse.h"
+
+static bool diff_changed(const DiffRule *r, double prev, double cur);
+static void diff_datapoint(const Config *c, const Location *l, const char *block,
+              const Datapoint *prev, const Datapoint *cur, FILE *out);
+static void diff_datablock(const Config *c, const Location *l, const char *block,
+              const Datablock *prev, const Datablock *cur, FILE *out);
+
+bool diff_changed(const DiffRule *r, double prev, double cur) {
+  if(isnan(prev) || isnan(cur))
+    return false;
+
+  switch(r->kind) {
+    case DIFF_THRESHOLD:
+      return (prev < r->value) != (cur < r->value);
+    case DIFF_DELTA:
+      return fabs(cur - prev) > r->value;
+    default:
+      return false;
+  }
+}
+
+void diff_datapoint(const Config *c, const Location *l, const char *block,
+    const Datapoint *prev, const Datapoint *cur, FILE *out) {
+  for(int i = 0; i < c->diff_rules_len; i++) {
+    const DatapointField *field = &datapoint_fields[c->diff_rules[i].field];
+    const double p = datapoint_value(prev, field);
+    const double v = datapoint_value(cur, field);
+
+    if(diff_changed(&c->diff_rules[i], p, v))
+      fprintf(out, "%s\t%s\t%lld\t%s\t%.15g\t%.15g\n", l->name ?: "", block,
+          (long long) cur->time, field->key, p, v);
+  }
+}
+
+/* Both blocks are ordered by time */
+void diff_datablock(const Config *c, const Location *l, const char *block,
+    const Datablock *prev, const Datablock *cur, FILE *out) {
+  int i = 0, j = 0;
+
+  while(i < prev->len && j < cur->len) {
+    if(prev->data[i].time < cur->data[j].time)
+      i++;
+    else if(prev->data[i].time > cur->data[j].time)
+      j++;
+    else
+      diff_datapoint(c, l, block, &prev->data[i++], &cur->data[j++], out);
+  }
+}
+
+int diff_forecast(const Config *c, const Location *l, const Forecast *prev,
+    const Forecast *cur, FILE *out) {
+  const int both = prev->blocks & cur->blocks;
+
+  /* The current conditions are always compared with the last known ones */
+  if(both & BLOCK_CURRENTLY)
+    diff_datapoint(c, l, "currently", &prev->currently, &cur->currently, out);
+  if(both & BLOCK_HOURLY)
+    diff_datablock(c, l, "hourly", &prev->hourly, &cur->hourly, out);
+  if(both & BLOCK_DAILY)
+    diff_datablock(c, l, "daily", &prev->daily, &cur->daily, out);
+
+  if(ferror(out)) {
+    FERROR(errno, "write");
+    return -1;
+  }
+
+  return 0;
+}
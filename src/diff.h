@@ -0,0 +1,33 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stdio.h>
+
+#include "forecast.h"
+
+/* Writes one tab separated line of location, block, time, field, old and
+ * new value for every data point value in cur that changed against
+ * prev according to c->diff_rules. Data points are matched by their
+ * time; points only present in one of the forecasts are skipped. */
+int diff_forecast(const Config *c, const Location *l, const Forecast *prev,
+      const Forecast *cur, FILE *out);
+
+#endif
@@ -16,59 +16,202 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* strptime */
+
 #include <getopt.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#include "barplot.h"
-#include "cache.h"
-#include "configfile.h"
-#include "forecast.h"
-#include "network.h"
-#include "render.h"
+#include "config.h"
+#include "libforecast.h"
 
-#define FREE_IF(flag, var) if(flag == true) free((void*)(var))
+#define EXIT_ALERT 2
 
 /* globals */
 
-#define CLI_OPTIONS "c:dhl:m:rv"
+#define CLI_OPTIONS "ac:dF:H:hj:L:l:m:P:prtv"
 static const char *options = CLI_OPTIONS;
 static const struct option options_long[] = {
-  { "help",     no_argument,        NULL, 'h' },
-  { "location", required_argument,  NULL, 'l' },
-  { "config",   required_argument,  NULL, 'c' },
-  { "version",  no_argument,        NULL, 'v' },
-  { "mode",     required_argument,  NULL, 'm' },
-  { "dump",     no_argument,        NULL, 'd' },
-  { "request",  no_argument,        NULL, 'r' },
-  { 0,          0,                  0,    0   }
+  { "all",            no_argument,        NULL, 'a' },
+  { "fields",         required_argument,  NULL, 'F' },
+  { "history",        required_argument,  NULL, 'H' },
+  { "help",           no_argument,        NULL, 'h' },
+  { "jobs",           required_argument,  NULL, 'j' },
+  { "location",       required_argument,  NULL, 'l' },
+  { "location-name",  required_argument,  NULL, 'L' },
+  { "config",         required_argument,  NULL, 'c' },
+  { "version",        no_argument,        NULL, 'v' },
+  { "mode",           required_argument,  NULL, 'm' },
+  { "dump",           no_argument,        NULL, 'd' },
+  { "prefetch",       no_argument,        NULL, 'p' },
+  { "proxy",          required_argument,  NULL, 'P' },
+  { "request",        no_argument,        NULL, 'r' },
+  { "timings",        no_argument,        NULL, 't' },
+  { 0,                0,                  0,    0   }
 };
 
+typedef struct {
+  bool bypass_cache;
+  bool dump_data;
+  bool prefetch;
+  bool timings;
+  int failed;
+  int alerted;
+} RunOpts;
+
+static int    batch_work(const Config *c, BatchJob *j, void *arg);
+static void   batch_done(const Config *c, const BatchJob *j, void *arg);
 static int    parse_location(const char *s, double *la, double *lo);
+static int    parse_listen(char *s, const char **address, int *port);
+static void   on_signal(int sig);
+static int    parse_time(const char *s, const char *end, time_t *t);
+static int    parse_time_range(const char *s, time_t *from, time_t *to);
 static void   usage(void);
 
+/* Runs on a worker thread: everything but the output itself */
+int batch_work(const Config *c, BatchJob *j, void *arg) {
+  const RunOpts *o = (const RunOpts*) arg;
+  Timings *t = o->timings ? &j->timings : NULL;
+  Data d = DATA_NULL;
+  Forecast f = FORECAST_NULL;
+  int ret = 0;
+
+  if(c->op == OP_DIFF && o->prefetch == false && o->dump_data == false)
+    return forecast_diff(c, j->location, &j->out, &j->outlen, t);
+
+  if(forecast_fetch(c, j->location, &d, o->bypass_cache, t) != 0)
+    return -1;
+  if(d.stale == true)
+    strncpy(j->error, forecast_strerror(), sizeof(j->error) - 1);
+
+  if(o->prefetch == true)
+    forecast_history(c, j->location, &d, NULL, t);
+  else if(o->dump_data == true) {
+    forecast_history(c, j->location, &d, NULL, t);
+    if(codec_decompress(&d) != 0) {
+      free_data(&d);
+      return -1;
+    }
+    j->out = d.data;
+    j->outlen = d.datalen;
+    d = (Data) DATA_NULL;
+  } else if(forecast_parse(&d, &f, t) != 0)
+    ret = -1;
+  else {
+    forecast_history(c, j->location, &d, &f, t);
+    ret = forecast_render_buffer(c, j->location, &f, &j->out, &j->outlen, t);
+  }
+
+  free_forecast(&f);
+  free_data(&d);
+
+  return ret;
+}
+
+void batch_done(const Config *c, const BatchJob *j, void *arg) {
+  RunOpts *o = (RunOpts*) arg;
+
+  if(o->timings == true)
+    timings_print(&j->timings, j->location->name, stderr);
+
+  if(j->status != 0) {
+    LERROR(0, 0, "Failed to request data for %s: %s",
+        j->location->name ? j->location->name : "location", j->error);
+    o->failed++;
+    return;
+  }
+
+  if(j->error[0] != '\0')
+    LERROR(0, 0, "Serving an expired forecast for %s: %s",
+        j->location->name ? j->location->name : "location", j->error);
+
+  if(c->op == OP_ALERT && j->outlen > 0)
+    o->alerted++;
+
+  if(j->out != NULL)
+    fwrite(j->out, 1, j->outlen, stdout);
+  if(o->dump_data == true && o->prefetch == false)
+    putchar('\n');
+}
+
+/* LATITUDE:LONGITUDE */
 int parse_location(const char *s, double *la, double *lo) {
-  char *buf, *col, *e;
+  char *e;
+
+  *la = strtod(s, &e);
+  if(e == s || *e != ':')
+    return -1;
+  s = e + 1;
+  *lo = strtod(s, &e);
+  if(e == s || *e != '\0')
+    return -1;
+
+  return 0;
+}
+
+/* [ADDRESS:]PORT; s is modified */
+int parse_listen(char *s, const char **address, int *port) {
+  char *colon = strrchr(s, ':'), *e;
+  long p;
+
+  *address = NULL;
+  if(colon != NULL) {
+    *colon = '\0';
+    *address = s;
+    s = colon + 1;
+  }
+  p = strtol(s, &e, 10);
+  if(e == s || *e != '\0' || p < 1 || p > 65535)
+    return -1;
+  *port = p;
+
+  return 0;
+}
+
+void on_signal(int sig) {
+  proxy_stop();
+}
+
+/* Seconds since the epoch or YYYY-MM-DD[THH:MM[:SS]] in UTC */
+int parse_time(const char *s, const char *end, time_t *t) {
+  struct tm tm = { 0 };
+  char buf[32], *e;
 
-  if((col = strchr(s, ':')) == NULL)
+  if(end - s >= sizeof(buf))
     return -1;
+  memcpy(buf, s, end - s);
+  buf[end - s] = '\0';
 
-  buf = malloc(col - s + 1);
-  GUARD_MALLOC(buf);
-
-  memcpy(buf, s, col - s + 1);
-  buf[col-s] = '\0';
-  *la = strtod(buf, NULL);
-  e = (char*) s;
-  while(*e++);
-  buf = realloc(buf, e - col);
-  GUARD_MALLOC(buf);
-  memcpy(buf, col + 1, e - col);
-  buf[e-col-1] = '\0';
-  *lo = strtod(buf, NULL);
-  free(buf);
+  if((e = strptime(buf, "%Y-%m-%d", &tm)) != NULL) {
+    if(*e == 'T' && (e = strptime(e + 1, "%H:%M", &tm)) != NULL && *e == ':')
+      e = strptime(e + 1, "%S", &tm);
+    if(e == NULL || *e != '\0')
+      return -1;
+    *t = timegm(&tm);
+    return 0;
+  }
+
+  *t = strtoll(buf, &e, 10);
+  return *e == '\0' && e != buf ? 0 : -1;
+}
+
+/* FROM/TO where either side may be left empty */
+int parse_time_range(const char *s, time_t *from, time_t *to) {
+  const char *sep = strchr(s, '/');
+
+  *from = 0;
+  *to = (time_t) INT64_MAX;
+
+  if(sep == NULL)
+    return -1;
+  if(sep != s && parse_time(s, sep, from) != 0)
+    return -1;
+  if(sep[1] != '\0' && parse_time(sep + 1, sep + strlen(sep), to) != 0)
+    return -1;
 
   return 0;
 }
@@ -77,15 +220,36 @@ void usage(void) {
   puts("Usage:\n"
        "  forecast [" CLI_OPTIONS "] [OPTIONS]\n"
        "Options:\n"
+       "  -a|--all              Operate on all configured locations in turn\n"
        "  -c|--config    PATH   Configuration file to use\n"
        "  -d|--dump             Dump the JSON data and a newline to stdout\n"
+       "  -F|--fields    LIST   Comma separated data point fields to print with --history.\n"
+       "                        Defaults to all of them\n"
+       "  -H|--history   FROM/TO\n"
+       "                        Print the forecasts recorded in history_dir which were fetched\n"
+       "                        between FROM and TO as tab separated values. The times are\n"
+       "                        seconds since the epoch or YYYY-MM-DD[THH:MM[:SS]] in UTC;\n"
+       "                        either may be omitted\n"
        "  -h|--help             Print this message and exit\n"
+       "  -j|--jobs      N      Number of locations to process in parallel with --all.\n"
+       "                        Defaults to the number of CPUs. Plot modes are always serial\n"
+       "  -L|--location-name NAME\n"
+       "                        Query the weather at the configured location called NAME\n"
        "  -l|--location  CHOORD Query the weather at this location; CHOORD is a string in the format\n"
        "                        <latitude>:<longitude> where the choordinates are given as floating\n"
        "                        point numbers\n"
        "  -m|--mode      MODE   One of print, print-hourly, plot-hourly, plot-daily, plot-precip-daily,\n"
-       "                        plot-precip-hourly, plot-daylight. Defaults to 'print'\n"
+       "                        plot-precip-hourly, plot-precip-minutely, plot-daylight, diff, alert.\n"
+       "                        Defaults to 'print'.\n"
+       "                        In alert mode, the exit status is 2 if any alert matched\n"
+       "  -P|--proxy     [ADDRESS:]PORT\n"
+       "                        Serve forecasts from the cache to other forecast clients over\n"
+       "                        HTTP until interrupted; they set api_url to http://HOST:PORT/forecast.\n"
+       "                        ADDRESS defaults to all interfaces\n"
+       "  -p|--prefetch         Only refresh the cache, don't output anything\n"
        "  -r|--request          By pass the cache if a cache file exists\n"
+       "  -t|--timings          Print how long each phase took to stderr. Also enabled by\n"
+       "                        setting FORECAST_TIMINGS in the environment\n"
        "  -v|--version          Print program version and exit"
        );
 }
@@ -93,28 +257,67 @@ void usage(void) {
 int main(int argc, char **argv) {
 
   Config c = CONFIG_NULL;
-  Data d = DATA_NULL;
+  Location cli_location = LOCATION_NULL;
+  Location *first, *last, *l;
+  const char *location_name = NULL;
+  const char *history_fields = NULL;
+  bool history = false;
+  const char *proxy_address = NULL;
+  int proxy_port = 0;
+  time_t history_from, history_to;
   int opt;
-  bool dump_data = false;
-  bool bypass_cache = false;
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  bool all_locations = false;
+  const char *timings_env = getenv("FORECAST_TIMINGS");
+  const uint64_t start = timings_now();
+  Timings timings = TIMINGS_NULL;
+  RunOpts o = {
+    .bypass_cache = false,
+    .dump_data = false,
+    .prefetch = false,
+    .timings = timings_env != NULL && *timings_env != '\0' && strcmp(timings_env, "0") != 0,
+    .failed = 0,
+    .alerted = 0
+  };
 
-  set_config_path(&c);
-  if(load_config(&c) != 0)
-    LERROR(EXIT_FAILURE, 0, "Failed to load the configuration file");
+  if(set_config_path(&c) != 0 || load_config(&c) != 0)
+    LERROR(EXIT_FAILURE, 0, "Failed to load the configuration file: %s",
+        forecast_strerror());
+  timings_record(&timings, "config", start);
 
   while((opt = getopt_long(argc, argv, options, options_long, NULL)) != -1) {
     switch(opt) {
       case 'h':
         usage();
         return EXIT_SUCCESS;
+      case 'a':
+        all_locations = true;
+        break;
+      case 'F':
+        history_fields = optarg;
+        break;
+      case 'H':
+        if(parse_time_range(optarg, &history_from, &history_to) != 0)
+          LERROR(EXIT_FAILURE, 0, "-H: malformed time range: %s", optarg);
+        history = true;
+        break;
+      case 'L':
+        location_name = optarg;
+        break;
       case 'l':
-        if(parse_location((const char*)optarg, &c.location.latitude, &c.location.longitude) == -1)
+        if(parse_location((const char*)optarg, &cli_location.latitude, &cli_location.longitude) == -1)
           puts("-l: malformed option argument");
-        bypass_cache = true;
+        c.location = &cli_location;
         break;
       case 'c':
         c.path = optarg;
         break;
+      case 'j':
+        if((jobs = atoi(optarg)) < 1) {
+          puts("-j: invalid number of jobs, using 1");
+          jobs = 1;
+        }
+        break;
       case 'v':
         puts(PACKAGE_STRING);
         puts("Compiled on: " __DATE__ " " __TIME__);
@@ -130,10 +333,20 @@ int main(int argc, char **argv) {
         }
         break;
       case 'd':
-        dump_data = true;
+        o.dump_data = true;
+        break;
+      case 'P':
+        if(parse_listen(optarg, &proxy_address, &proxy_port) != 0)
+          LERROR(EXIT_FAILURE, 0, "-P: expected [ADDRESS:]PORT: %s", optarg);
+        break;
+      case 'p':
+        o.prefetch = true;
         break;
       case 'r':
-        bypass_cache = true;
+        o.bypass_cache = true;
+        break;
+      case 't':
+        o.timings = true;
         break;
     }
   }
@@ -144,23 +357,91 @@ int main(int argc, char **argv) {
   if(string_isalnum(c.apikey) == -1)
     LERROR(EXIT_FAILURE, 0, "API key is not a hexstring.", c.apikey);
 
-  if(bypass_cache == true || load_cache(&c, &d) == -1) {
-    if(request(&c, &d) != 0)
-      puts("Failed to request data");
-    else
-      save_cache(&c, &d);
-  }
+  /* Only cached with a cache_tolerance */
+  cli_location.max_cache_age = c.max_cache_age;
+  cli_location.cache_expiry = c.cache_expiry;
+  cli_location.max_data_age = c.max_data_age;
+  cli_location.compress = c.cache_compress;
 
-  if(dump_data) {
-    write(STDOUT_FILENO, d.data, d.datalen);
-    putchar('\n');
+  if(c.op == OP_ALERT && c.alert_rules_len == 0)
+    LERROR(EXIT_FAILURE, 0, "alert mode: no alerts configured");
+
+  if(location_name != NULL)
+    if((c.location = find_location(&c, location_name)) == NULL)
+      LERROR(EXIT_FAILURE, 0, "-L: no such location: %s", location_name);
+
+  if(all_locations == true) {
+    first = &c.locations[0];
+    last = &c.locations[c.locations_len - 1];
+  } else
+    first = last = c.location;
+
+  if(o.timings == true)
+    timings_print(&timings, NULL, stderr);
+
+  if(proxy_port != 0) {
+    struct sigaction sa = { .sa_handler = on_signal };
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if(proxy_run(&c, proxy_address, proxy_port) != 0)
+      LERROR(EXIT_FAILURE, 0, "%s", forecast_strerror());
+  } else if(history == true) {
+    /* Only reads what earlier runs have recorded */
+    for(l = first; l <= last; l++)
+      if(history_query(&c, l, history_from, history_to, history_fields, l == first, stdout) != 0) {
+        LERROR(0, 0, "%s", forecast_strerror());
+        o.failed++;
+      }
+  } else if(o.prefetch == true || o.dump_data == true || OP_IS_TEXT(c.op) || c.op == OP_DIFF) {
+    if(batch_run(&c, first, last - first + 1, jobs, batch_work, batch_done, &o) != 0)
+      LERROR(EXIT_FAILURE, 0, "%s", forecast_strerror());
   } else
-    render(&c, &d);
+    /* The plots take over the terminal one after another */
+    for(l = first; l <= last; l++) {
+      Data d = DATA_NULL;
+      Forecast f = FORECAST_NULL;
+      Timings *t = o.timings ? &timings : NULL;
+      int ret;
+
+      timings.len = 0;
+      if(forecast_fetch(&c, l, &d, o.bypass_cache, t) != 0) {
+        LERROR(0, 0, "Failed to request data for %s: %s",
+            l->name ? l->name : "location", forecast_strerror());
+        o.failed++;
+      } else {
+        if(d.stale == true)
+          LERROR(0, 0, "Serving an expired forecast for %s: %s",
+              l->name ? l->name : "location", forecast_strerror());
+        if((ret = forecast_parse(&d, &f, t)) == 0) {
+          forecast_history(&c, l, &d, &f, t);
+          ret = forecast_render(&c, l, &f, stdout, t);
+        }
+        if(ret != 0) {
+          LERROR(0, 0, "%s", forecast_strerror());
+          o.failed++;
+        }
+      }
+      timings_print(t, l->name, stderr);
 
-  if(d.data != NULL)
-    free(d.data);
+      free_forecast(&f);
+      free_data(&d);
+    }
+
+  if(c.metrics_file != NULL && metrics_write(c.metrics_file) != 0)
+    LERROR(0, 0, "Failed to write metrics: %s", forecast_strerror());
+
+  if(o.timings == true) {
+    timings.len = 0;
+    timings_record(&timings, "total", start);
+    timings_print(&timings, NULL, stderr);
+  }
 
+  forecast_cleanup();
   free_config(&c);
 
-  return EXIT_SUCCESS;
+  /* Matching alerts take precedence, the failures were reported already */
+  if(o.alerted > 0)
+    return EXIT_ALERT;
+  return o.failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
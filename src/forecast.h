@@ -22,15 +22,29 @@
 
 #include <errno.h>
 #include <error.h>
+#include <stdbool.h>
+#include <time.h>
 
+#include "arena.h"
 #include "barplot.h"
-#include "config.h"
 
 #define LERROR(status, errnum, ...) error_at_line((status), (errnum), \
         (__func__), (__LINE__), __VA_ARGS__)
-#define GUARD_MALLOC(v) \
-  if((v) == NULL)       \
-    LERROR(EXIT_FAILURE, errno, "malloc(%s) returned NULL", #v);
+
+/* Library code must not terminate the process: it records what went
+ * wrong for the calling thread, see forecast_strerror(), and returns
+ * an error value instead */
+#define FERROR(errnum, ...) forecast_seterror((errnum), (__func__), __VA_ARGS__)
+#define GUARD_ALLOC(v, ret)                           \
+  if((v) == NULL) {                                   \
+    FERROR(errno, "malloc(%s) returned NULL", #v);    \
+    return (ret);                                     \
+  }
+
+#define FORECAST_ERROR_MAX 512
+
+/* Requests go to $api_url/APIKEY/LATITUDE,LONGITUDE */
+#define FORECAST_API_URL "https://api.forecast.io/forecast"
 
 /* types */
 
@@ -41,45 +55,253 @@ enum {
   OP_PRINT_HOURLY,
   OP_PLOT_PRECIPITATION_HOURLY,
   OP_PLOT_PRECIPITATION_DAILY,
-  OP_PLOT_DAYLIGHT
+  OP_PLOT_PRECIPITATION_MINUTELY,
+  OP_PLOT_DAYLIGHT,
+  OP_DIFF,
+  OP_ALERT
+};
+
+#define OP_IS_TEXT(op) ((op) == OP_PRINT_CURRENTLY || (op) == OP_PRINT_HOURLY \
+    || (op) == OP_ALERT)
+
+enum {
+  CACHE_EXPIRY_AGE,   /* after max_cache_age seconds */
+  CACHE_EXPIRY_DATA   /* also once the data is out of date, see cache.h */
+};
+
+enum {
+  BLOCK_CURRENTLY = 1 << 0,
+  BLOCK_HOURLY    = 1 << 1,
+  BLOCK_DAILY     = 1 << 2,
+  BLOCK_MINUTELY  = 1 << 3
 };
 
+typedef struct {
+  char *name;
+  double latitude;
+  double longitude;
+  char *cache_file;
+  int max_cache_age;
+  int cache_expiry;   /* CACHE_EXPIRY_* */
+  int max_data_age;   /* s, 0 for any; with CACHE_EXPIRY_DATA */
+  char *exclude;      /* forecast.io data blocks not to request */
+  bool compress;      /* store the cache file gzip compressed */
+} Location;
+
+#define LOCATION_NULL               \
+{                                   \
+  .name = NULL,                     \
+  .latitude = 0.0,                  \
+  .longitude = 0.0,                 \
+  .cache_file = NULL,               \
+  .max_cache_age = 0,               \
+  .cache_expiry = CACHE_EXPIRY_AGE, \
+  .max_data_age = 0,                \
+  .exclude = NULL,                  \
+  .compress = false                 \
+}
+
+enum {
+  DIFF_THRESHOLD,     /* value crossed a threshold in either direction */
+  DIFF_DELTA          /* value moved by more than a given amount */
+};
+
+typedef struct {
+  int field;          /* index into datapoint_fields */
+  int kind;
+  double value;
+} DiffRule;
+
+enum {
+  ALERT_LT,
+  ALERT_LE,
+  ALERT_GT,
+  ALERT_GE,
+  ALERT_EQ,
+  ALERT_NE
+};
+
+typedef struct {
+  char *name;
+  int block;          /* BLOCK_* */
+  int field;          /* index into datapoint_fields */
+  int cmp;            /* ALERT_* */
+  double value;
+  int within;         /* hours or days ahead, 0 for all */
+} AlertRule;
+
 typedef struct {
   char *path;
   const char *apikey;
+  const char *api_url;
   char *cache_file;
-  struct {
-    double latitude;
-    double longitude;
-  } location;
+  char *metrics_file;
+  char *record_file;        /* replay archive to append responses to */
+  char *replay_file;        /* replay archive to serve responses from */
+  bool replay_timing;       /* take as long as the recorded responses */
+  char *history_dir;
+  bool history_compress;
+  Location *locations;
+  int locations_len;
+  Location *location;   /* the location currently operated on */
+  DiffRule *diff_rules;
+  int diff_rules_len;
+  AlertRule *alert_rules;
+  int alert_rules_len;
   PlotCfg plot;
   int op;
   int max_cache_age;
+  int cache_expiry;         /* CACHE_EXPIRY_* */
+  int max_data_age;         /* s, 0 for any; with CACHE_EXPIRY_DATA */
+  bool cache_compress;
+  double cache_tolerance;   /* km, 0 to only cache configured locations */
+  bool cache_stale_fallback;  /* serve an expired cache if requests fail */
+  struct {
+    int connect_timeout;    /* ms */
+    int timeout;            /* ms, for each attempt */
+    int retries;            /* attempts after the first */
+    int backoff;            /* ms before the first retry, doubling */
+    int hedge_delay;        /* ms before a second request, 0 for none */
+  } request;
+  Arena arena;              /* everything above points into it */
 } Config;
 
-#define CONFIG_NULL         \
-{                           \
-  .path = NULL,             \
-  .apikey = NULL,           \
-  .cache_file = NULL,       \
-  .max_cache_age = 0,       \
-  .location = {             \
-    .latitude = 0.0,        \
-    .longitude = 0.0,       \
-  },                        \
-  .plot = PLOTCFG_DEFAULT,  \
-  .op = OP_PRINT_CURRENTLY  \
+#define CONFIG_NULL                 \
+{                                   \
+  .path = NULL,                     \
+  .apikey = NULL,                   \
+  .api_url = FORECAST_API_URL,      \
+  .cache_file = NULL,               \
+  .metrics_file = NULL,             \
+  .record_file = NULL,              \
+  .replay_file = NULL,              \
+  .replay_timing = false,           \
+  .history_dir = NULL,              \
+  .history_compress = true,         \
+  .max_cache_age = 0,               \
+  .cache_expiry = CACHE_EXPIRY_AGE, \
+  .max_data_age = 0,                \
+  .cache_compress = false,          \
+  .cache_tolerance = 0.0,           \
+  .cache_stale_fallback = true,     \
+  .request = {                      \
+    .connect_timeout = 5000,        \
+    .timeout = 20000,               \
+    .retries = 2,                   \
+    .backoff = 500,                 \
+    .hedge_delay = 0                \
+  },                                \
+  .locations = NULL,                \
+  .locations_len = 0,               \
+  .location = NULL,                 \
+  .diff_rules = NULL,               \
+  .diff_rules_len = 0,              \
+  .alert_rules = NULL,              \
+  .alert_rules_len = 0,             \
+  .plot = PLOTCFG_DEFAULT,          \
+  .op = OP_PRINT_CURRENTLY,         \
+  .arena = ARENA_NULL               \
 }
 
+enum {
+  CODEC_NONE,
+  CODEC_GZIP
+};
+
 typedef struct {
   char *data;
   size_t datalen;
+  size_t datacap;     /* allocated size of data while it is received */
+  int codec;          /* of data; CODEC_NONE means NUL terminated JSON */
+  size_t rawlen;      /* length of the JSON once decompressed */
+  bool stale;         /* from an expired cache because the request failed */
+  bool fetched;       /* from the API rather than a cache */
+  struct {            /* filled in by request(), see curl_easy_getinfo(3) */
+    double namelookup;
+    double connect;
+    double appconnect;
+    double starttransfer;
+    double total;
+    double size_download;
+  } transfer;
 } Data;
 
 #define DATA_NULL           \
 {                           \
   .data = NULL,             \
-  .datalen = 0              \
+  .datalen = 0,             \
+  .datacap = 0,             \
+  .codec = CODEC_NONE,      \
+  .rawlen = 0,              \
+  .stale = false,           \
+  .fetched = false,         \
+  .transfer = { 0 }         \
+}
+
+/* A forecast.io data point. Values missing from the response are NAN,
+ * or 0 for times. Hourly and daily data points share this type; fields
+ * that only exist in one of them are unset in the other. */
+typedef struct {
+  time_t time;
+  char *summary;
+  double temperature;
+  double apparentTemperature;
+  double temperatureMin;
+  double temperatureMax;
+  double dewPoint;
+  double humidity;
+  double precipProbability;
+  double precipIntensity;
+  double cloudCover;
+  double windSpeed;
+  double windBearing;
+  double pressure;
+  double ozone;
+  time_t sunriseTime;
+  time_t sunsetTime;
+} Datapoint;
+
+typedef struct {
+  char *summary;
+  Datapoint *data;
+  int len;
+} Datablock;
+
+#define DATABLOCK_NULL      \
+{                           \
+  .summary = NULL,          \
+  .data = NULL,             \
+  .len = 0                  \
 }
 
+typedef struct {
+  double latitude;
+  double longitude;
+  char *timezone;
+  double offset;
+  int blocks;         /* BLOCK_* flags of the blocks present */
+  Datapoint currently;
+  Datablock minutely;
+  Datablock hourly;
+  Datablock daily;
+  Arena arena;        /* holds the strings and data point arrays */
+} Forecast;
+
+#define FORECAST_NULL         \
+{                             \
+  .latitude = 0.0,            \
+  .longitude = 0.0,           \
+  .timezone = NULL,           \
+  .offset = 0.0,              \
+  .blocks = 0,                \
+  .minutely = DATABLOCK_NULL, \
+  .hourly = DATABLOCK_NULL,   \
+  .daily = DATABLOCK_NULL,    \
+  .arena = ARENA_NULL         \
+}
+
+void        forecast_seterror(int errnum, const char *func, const char *fmt, ...)
+              __attribute__((format(printf, 3, 4)));
+const char* forecast_strerror(void);
+
 #endif
@@ -0,0 +1,410 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "history.h"
+#include "parse.h"
+
+#define HISTORY_MAGIC "FCHIST1"
+
+enum {
+  SEGMENT_RAW,
+  SEGMENT_ZLIB
+};
+
+typedef struct {
+  char magic[8];
+  uint32_t columns;
+  uint32_t reserved;
+  char names[HISTORY_COLUMNS_MAX][HISTORY_NAME_MAX];
+} HistoryHeader;
+
+typedef struct {
+  int64_t fetched;
+  uint32_t block;
+  uint32_t count;
+  struct {
+    uint64_t offset;
+    uint32_t length;    /* stored bytes, 0 if the column is absent */
+    uint32_t codec;
+  } segments[HISTORY_COLUMNS_MAX];
+} HistoryEntry;
+
+static const struct {
+  int block;
+  const char *name;
+} history_blocks[] = {
+  { BLOCK_HOURLY, "hourly" },
+  { BLOCK_DAILY,  "daily"  }
+};
+
+static int          history_dir(const Config *c, const Location *l, char *path, size_t len);
+static int          history_open_index(const char *dir, int flags, HistoryHeader *h);
+static int          history_column(const HistoryHeader *h, const char *name);
+static const char*  history_block_name(int block);
+static int          history_append_block(const char *dir, const HistoryHeader *h, bool compress,
+                      int block, const Datablock *b, HistoryEntry *e);
+static double*      history_read_segment(const char *dir, const char *block, const char *name,
+                      const HistoryEntry *e, int col);
+
+/* history_dir/<location name, or latitude,longitude> */
+int history_dir(const Config *c, const Location *l, char *path, size_t len) {
+  int n;
+
+  if(l->name != NULL)
+    n = snprintf(path, len, "%s/%s", c->history_dir, l->name);
+  else
+    n = snprintf(path, len, "%s/%.4f,%.4f", c->history_dir, l->latitude, l->longitude);
+
+  if(n >= len) {
+    FERROR(0, "history path too long");
+    return -1;
+  }
+
+  /* names come from the configuration and must not escape the directory */
+  for(char *p = path + strlen(c->history_dir) + 1; *p != '\0'; p++)
+    if(*p == '/')
+      *p = '_';
+
+  return 0;
+}
+
+const char* history_block_name(int block) {
+  for(int i = 0; i < sizeof(history_blocks)/sizeof(history_blocks[0]); i++)
+    if(history_blocks[i].block == block)
+      return history_blocks[i].name;
+  return "unknown";
+}
+
+int history_column(const HistoryHeader *h, const char *name) {
+  for(int i = 0; i < h->columns; i++)
+    if(strncmp(h->names[i], name, HISTORY_NAME_MAX) == 0)
+      return i;
+  return -1;
+}
+
+/* Opens and locks the index, creating it with the current set of
+ * numeric fields as columns if necessary */
+int history_open_index(const char *dir, int flags, HistoryHeader *h) {
+  char path[PATH_MAX];
+  struct stat s;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/index", dir);
+
+  if((fd = open(path, flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) {
+    FERROR(errno, "open(%s)", path);
+    return -1;
+  }
+
+  if(flock(fd, (flags & O_ACCMODE) == O_RDONLY ? LOCK_SH : LOCK_EX) != 0
+      || fstat(fd, &s) != 0) {
+    FERROR(errno, "%s", path);
+    close(fd);
+    return -1;
+  }
+
+  if(s.st_size == 0 && (flags & O_ACCMODE) != O_RDONLY) {
+    memset(h, 0, sizeof(HistoryHeader));
+    memcpy(h->magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC));
+    for(int i = 0; i < datapoint_fields_len && h->columns < HISTORY_COLUMNS_MAX; i++)
+      if(datapoint_fields[i].type != FIELD_STRING)
+        strncpy(h->names[h->columns++], datapoint_fields[i].key, HISTORY_NAME_MAX - 1);
+    if(write(fd, h, sizeof(HistoryHeader)) != sizeof(HistoryHeader)) {
+      FERROR(errno, "write(%s)", path);
+      close(fd);
+      return -1;
+    }
+  } else if(pread(fd, h, sizeof(HistoryHeader), 0) != sizeof(HistoryHeader)
+      || memcmp(h->magic, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) != 0) {
+    FERROR(0, "%s is not a history index", path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int history_append_block(const char *dir, const HistoryHeader *h, bool compress,
+    int block, const Datablock *b, HistoryEntry *e) {
+  const size_t rawlen = b->len * sizeof(double);
+  double *raw = NULL;
+  Bytef *packed = NULL;
+  uLongf packedlen = compressBound(rawlen);
+  int ret = -1;
+
+  e->block = block;
+  e->count = b->len;
+
+  raw = malloc(rawlen);
+  GUARD_ALLOC(raw, -1);
+  if(compress && (packed = malloc(packedlen)) == NULL) {
+    FERROR(errno, "malloc()");
+    goto return_error;
+  }
+
+  for(int i = 0; i < datapoint_fields_len; i++) {
+    const DatapointField *field = &datapoint_fields[i];
+    const int col = history_column(h, field->key);
+    char path[PATH_MAX];
+    const void *seg = raw;
+    struct stat s;
+    int fd;
+
+    if(field->type == FIELD_STRING || col == -1)
+      continue;
+
+    for(int j = 0; j < b->len; j++)
+      raw[j] = datapoint_value(&b->data[j], field);
+
+    e->segments[col].length = rawlen;
+    e->segments[col].codec = SEGMENT_RAW;
+
+    /* Only keep the compressed segment if it actually is smaller */
+    if(compress) {
+      uLongf len = compressBound(rawlen);
+      if(compress2(packed, &len, (const Bytef*) raw, rawlen, Z_DEFAULT_COMPRESSION) == Z_OK
+          && len < rawlen) {
+        seg = packed;
+        e->segments[col].length = len;
+        e->segments[col].codec = SEGMENT_ZLIB;
+      }
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.%s", dir, history_block_name(block), field->key);
+    if((fd = open(path, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1
+        || fstat(fd, &s) != 0) {
+      FERROR(errno, "open(%s)", path);
+      if(fd != -1)
+        close(fd);
+      goto return_error;
+    }
+    e->segments[col].offset = s.st_size;
+    if(write(fd, seg, e->segments[col].length) != e->segments[col].length
+        || fdatasync(fd) != 0) {
+      FERROR(errno, "write(%s)", path);
+      close(fd);
+      goto return_error;
+    }
+    close(fd);
+  }
+
+  ret = 0;
+
+return_error:
+  free(packed);
+  free(raw);
+  return ret;
+}
+
+int history_append(const Config *c, const Location *l, const Forecast *f, time_t fetched) {
+  char dir[PATH_MAX];
+  HistoryHeader h;
+  struct stat s;
+  int fd, ret = 0;
+
+  if(c->history_dir == NULL)
+    return 0;
+
+  if(history_dir(c, l, dir, sizeof(dir)) != 0)
+    return -1;
+  if((mkdir(c->history_dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)
+      || (mkdir(dir, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0 && errno != EEXIST)) {
+    FERROR(errno, "mkdir(%s)", dir);
+    return -1;
+  }
+
+  if((fd = history_open_index(dir, O_RDWR | O_CREAT | O_APPEND, &h)) == -1)
+    return -1;
+
+  /* Drop a record left half-written by an interrupted append */
+  if(fstat(fd, &s) == 0 && (s.st_size - sizeof(HistoryHeader)) % sizeof(HistoryEntry) != 0
+      && ftruncate(fd, s.st_size - (s.st_size - sizeof(HistoryHeader)) % sizeof(HistoryEntry)) != 0) {
+    FERROR(errno, "ftruncate(%s/index)", dir);
+    close(fd);
+    return -1;
+  }
+
+  for(int i = 0; i < sizeof(history_blocks)/sizeof(history_blocks[0]) && ret == 0; i++) {
+    const Datablock *b = history_blocks[i].block == BLOCK_HOURLY ? &f->hourly : &f->daily;
+    HistoryEntry e;
+
+    if((f->blocks & history_blocks[i].block) == 0 || b->len == 0)
+      continue;
+
+    memset(&e, 0, sizeof(e));
+    e.fetched = fetched;
+
+    /* The index record commits the snapshot */
+    if(history_append_block(dir, &h, c->history_compress, history_blocks[i].block, b, &e) != 0)
+      ret = -1;
+    else if(write(fd, &e, sizeof(e)) != sizeof(e) || fdatasync(fd) != 0) {
+      FERROR(errno, "write(%s/index)", dir);
+      ret = -1;
+    }
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+double* history_read_segment(const char *dir, const char *block, const char *name,
+    const HistoryEntry *e, int col) {
+  const size_t rawlen = e->count * sizeof(double);
+  char path[PATH_MAX];
+  void *buf;
+  double *raw;
+  int fd;
+
+  if((raw = malloc(rawlen)) == NULL || (buf = malloc(e->segments[col].length)) == NULL) {
+    FERROR(errno, "malloc()");
+    free(raw);
+    return NULL;
+  }
+
+  snprintf(path, sizeof(path), "%s/%s.%s", dir, block, name);
+  if((fd = open(path, O_RDONLY)) == -1
+      || pread(fd, buf, e->segments[col].length, e->segments[col].offset) != e->segments[col].length) {
+    FERROR(errno, "read(%s)", path);
+    goto return_error;
+  }
+  close(fd);
+  fd = -1;
+
+  if(e->segments[col].codec == SEGMENT_ZLIB) {
+    uLongf len = rawlen;
+    if(uncompress((Bytef*) raw, &len, buf, e->segments[col].length) != Z_OK || len != rawlen) {
+      FERROR(0, "corrupt segment in %s", path);
+      goto return_error;
+    }
+  } else if(e->segments[col].length == rawlen)
+    memcpy(raw, buf, rawlen);
+  else {
+    FERROR(0, "corrupt segment in %s", path);
+    goto return_error;
+  }
+
+  free(buf);
+  return raw;
+
+return_error:
+  if(fd != -1)
+    close(fd);
+  free(buf);
+  free(raw);
+  return NULL;
+}
+
+/* Writes the snapshots fetched in [from, to] as tab separated rows of
+ * location, fetch time, block, data point time and the comma separated
+ * fields (all of them if NULL), preceded by a line of column names if
+ * header is set. Only the requested columns are read. */
+int history_query(const Config *c, const Location *l, time_t from, time_t to,
+    const char *fields, bool header, FILE *out) {
+  char dir[PATH_MAX];
+  char names[HISTORY_COLUMNS_MAX][HISTORY_NAME_MAX];
+  int cols[HISTORY_COLUMNS_MAX];
+  int ncols = 0, timecol;
+  HistoryHeader h;
+  HistoryEntry e;
+  off_t off;
+  int fd, ret = 0;
+
+  if(c->history_dir == NULL) {
+    FERROR(0, "history_dir is not configured");
+    return -1;
+  }
+  if(history_dir(c, l, dir, sizeof(dir)) != 0)
+    return -1;
+  if((fd = history_open_index(dir, O_RDONLY, &h)) == -1)
+    return -1;
+
+  if(fields == NULL) {
+    for(int i = 0; i < h.columns; i++)
+      if(strcmp(h.names[i], "time") != 0)
+        cols[ncols++] = i;
+  } else {
+    char buf[strlen(fields) + 1], *save, *tok;
+    strcpy(buf, fields);
+    for(tok = strtok_r(buf, ",", &save); tok != NULL && ncols < HISTORY_COLUMNS_MAX;
+        tok = strtok_r(NULL, ",", &save))
+      if((cols[ncols++] = history_column(&h, tok)) == -1) {
+        FERROR(0, "no such field: %s", tok);
+        close(fd);
+        return -1;
+      }
+  }
+  for(int i = 0; i < h.columns; i++)
+    strncpy(names[i], h.names[i], HISTORY_NAME_MAX);
+  timecol = history_column(&h, "time");
+
+  if(header == true) {
+    fprintf(out, "location\tfetched\tblock\ttime");
+    for(int i = 0; i < ncols; i++)
+      fprintf(out, "\t%.*s", HISTORY_NAME_MAX, names[cols[i]]);
+    fputc('\n', out);
+  }
+
+  for(off = sizeof(HistoryHeader); ret == 0 && pread(fd, &e, sizeof(e), off) == sizeof(e);
+      off += sizeof(e)) {
+    const char *block = history_block_name(e.block);
+    double *data[HISTORY_COLUMNS_MAX] = { NULL };
+    double *times;
+
+    if(e.fetched < from || e.fetched > to || e.count == 0 || timecol == -1)
+      continue;
+
+    if((times = history_read_segment(dir, block, names[timecol], &e, timecol)) == NULL) {
+      ret = -1;
+      break;
+    }
+    for(int i = 0; i < ncols; i++)
+      if(e.segments[cols[i]].length > 0
+          && (data[i] = history_read_segment(dir, block, names[cols[i]], &e, cols[i])) == NULL)
+        ret = -1;
+
+    for(int j = 0; ret == 0 && j < e.count; j++) {
+      fprintf(out, "%s\t%lld\t%s\t%.0f", l->name ?: "", (long long) e.fetched, block, times[j]);
+      for(int i = 0; i < ncols; i++)
+        if(data[i] != NULL)
+          fprintf(out, "\t%.15g", data[i][j]);
+        else
+          fputc('\t', out);
+      fputc('\n', out);
+    }
+
+    free(times);
+    for(int i = 0; i < ncols; i++)
+      free(data[i]);
+  }
+
+  close(fd);
+
+  return ret;
+}
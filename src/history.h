@@ -0,0 +1,44 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "forecast.h"
+
+/* Append-only store of every fetched forecast. Each location has a
+ * directory below history_dir holding one file per block and field
+ * (hourly.temperature, daily.temperatureMax, ...) to which every
+ * snapshot appends a segment of doubles, optionally zlib compressed,
+ * and an index listing the snapshots by fetch time together with the
+ * position of their segments. The index record is written last, so a
+ * crash can at worst leave unreferenced bytes in the column files. */
+
+#define HISTORY_COLUMNS_MAX 32
+#define HISTORY_NAME_MAX    24
+
+int history_append(const Config *c, const Location *l, const Forecast *f, time_t fetched);
+int history_query(const Config *c, const Location *l, time_t from, time_t to,
+      const char *fields, bool header, FILE *out);
+
+#endif
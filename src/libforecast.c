@@ -0,0 +1,249 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+
+#include "libforecast.h"
+
+static __thread char errbuf[FORECAST_ERROR_MAX];
+
+void forecast_seterror(int errnum, const char *func, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  n = snprintf(errbuf, sizeof(errbuf), "%s: ", func);
+
+  va_start(ap, fmt);
+  n += vsnprintf(&errbuf[n], sizeof(errbuf) - n, fmt, ap);
+  va_end(ap);
+
+  if(errnum != 0 && n < sizeof(errbuf) - 2) {
+    char ebuf[128];
+    if(strerror_r(errnum, ebuf, sizeof(ebuf)) == 0)
+      snprintf(&errbuf[n], sizeof(errbuf) - n, ": %s", ebuf);
+  }
+}
+
+const char* forecast_strerror(void) {
+  return errbuf;
+}
+
+/* Releases what the library set up on first use. Nothing is set up
+ * beforehand, so that cache hits don't pay for it: libcurl is loaded
+ * with the first request, see curlapi.h, and curses started with the
+ * first plot. */
+void forecast_cleanup(void) {
+  plotseries_free();
+  replay_close();
+  curlapi_unload();
+}
+
+static void transfer_timings(const Data *d, Timings *t);
+
+/* Breaks curl's cumulative times down into the duration of each step */
+void transfer_timings(const Data *d, Timings *t) {
+  const double connected = d->transfer.appconnect > 0.0 ?
+    d->transfer.appconnect : d->transfer.connect;
+
+  timings_value(t, "request.dns", 1e3 * d->transfer.namelookup, "ms");
+  timings_value(t, "request.connect", 1e3 * (d->transfer.connect - d->transfer.namelookup), "ms");
+  if(d->transfer.appconnect > 0.0)
+    timings_value(t, "request.tls", 1e3 * (d->transfer.appconnect - d->transfer.connect), "ms");
+  timings_value(t, "request.firstbyte", 1e3 * (d->transfer.starttransfer - connected), "ms");
+  timings_value(t, "request.transfer", 1e3 * (d->transfer.total - d->transfer.starttransfer), "ms");
+  timings_value(t, "request.downloaded", d->transfer.size_download, "bytes");
+  timings_value(t, "payload", d->datalen, "bytes");
+}
+
+/* Fills d from the location's cache or, if that isn't fresh, from the
+ * API, updating the cache. Forecasts from the API are only recorded in
+ * the history by forecast_history(), once the caller has parsed them. */
+int forecast_fetch(const Config *c, const Location *l, Data *d, bool bypass_cache,
+    Timings *t) {
+  /* Ad-hoc locations may be served from a nearby cached forecast */
+  const bool spatial = l->cache_file == NULL && c->cache_tolerance > 0.0;
+  uint64_t start = timings_now();
+  int ret;
+
+  if(bypass_cache == false && (l->cache_file != NULL || spatial)) {
+    ret = spatial ? spatial_load(c, l, d) : load_cache(l, d);
+    timings_record(t, ret == 0 ? "cache (hit)" : "cache (miss)", start);
+    if(ret == 0) {
+      timings_value(t, "payload", d->datalen, "bytes");
+      return 0;
+    }
+  }
+
+  start = timings_now();
+  ret = request(c, l, d);
+  timings_record(t, "request", start);
+  if(ret != 0) {
+    /* Better an expired forecast than none; the request's error stays
+     * available from forecast_strerror() */
+    char error[FORECAST_ERROR_MAX];
+
+    if(c->cache_stale_fallback == false || spatial || l->cache_file == NULL)
+      return -1;
+    strcpy(error, forecast_strerror());
+    start = timings_now();
+    if(load_cache_stale(l, d) != 0) {
+      FERROR(0, "%s; no cached forecast to fall back on", error);
+      return -1;
+    }
+    timings_record(t, "cache (stale)", start);
+    metrics_count(METRIC_CACHE_STALE_SERVES, 1);
+    d->stale = true;
+    return 0;
+  }
+  transfer_timings(d, t);
+  d->fetched = true;
+
+  /* Not being able to update the cache doesn't invalidate the data */
+  start = timings_now();
+  if(spatial)
+    spatial_save(c, l, d);
+  else
+    save_cache(l, d);
+  timings_record(t, "cache save", start);
+
+  return 0;
+}
+
+/* Appends f, parsed from d, to the history if d came from the API and
+ * a history is configured. Callers that don't parse d themselves pass
+ * NULL for f. Like failing to save the cache, failing to record the
+ * history doesn't invalidate the data, so there is nothing to return. */
+void forecast_history(const Config *c, const Location *l, const Data *d, const Forecast *f,
+    Timings *t) {
+  Forecast parsed = FORECAST_NULL;
+  uint64_t start;
+
+  if(c->history_dir == NULL || d->fetched == false)
+    return;
+
+  start = timings_now();
+  if(f == NULL && parse_forecast(d, &parsed) == 0)
+    f = &parsed;
+  if(f != NULL)
+    history_append(c, l, f, time(NULL));
+  free_forecast(&parsed);
+  timings_record(t, "history", start);
+}
+
+int forecast_parse(const Data *d, Forecast *f, Timings *t) {
+  uint64_t start = timings_now();
+  int ret = parse_forecast(d, f);
+  timings_record(t, "parse", start);
+  return ret;
+}
+
+int forecast_render(const Config *c, const Location *l, const Forecast *f, FILE *out,
+    Timings *t) {
+  uint64_t start = timings_now();
+  int ret = render(c, l, f, out);
+  timings_record(t, "render", start);
+  return ret;
+}
+
+/* Renders one of the text modes into a newly allocated, NUL terminated
+ * buffer which the caller must free() */
+int forecast_render_buffer(const Config *c, const Location *l, const Forecast *f,
+    char **buf, size_t *buflen, Timings *t) {
+  FILE *out;
+  int ret;
+
+  if(OP_IS_TEXT(c->op) == false) {
+    FERROR(0, "only the print modes can be rendered to a buffer");
+    return -1;
+  }
+
+  if((out = open_memstream(buf, buflen)) == NULL) {
+    FERROR(errno, "open_memstream()");
+    return -1;
+  }
+
+  ret = forecast_render(c, l, f, out, t);
+
+  if(fclose(out) != 0 && ret == 0) {
+    FERROR(errno, "fclose()");
+    ret = -1;
+  }
+
+  if(ret != 0) {
+    free(*buf);
+    *buf = NULL;
+    *buflen = 0;
+  }
+
+  return ret;
+}
+
+/* Fetches a fresh forecast and writes what changed against the one
+ * cached before into a newly allocated, NUL terminated buffer which the
+ * caller must free(). Without a usable previous forecast, nothing has
+ * changed. */
+int forecast_diff(const Config *c, const Location *l, char **buf, size_t *buflen,
+    Timings *t) {
+  Data prevd = DATA_NULL, d = DATA_NULL;
+  Forecast prev = FORECAST_NULL, cur = FORECAST_NULL;
+  uint64_t start;
+  FILE *out = NULL;
+  int ret = -1;
+
+  /* prev stays empty on failure */
+  if(load_cache_stale(l, &prevd) == 0)
+    parse_forecast(&prevd, &prev);
+
+  /* Comparing the cache with itself would be pointless */
+  if(forecast_fetch(c, l, &d, true, t) != 0 || d.stale == true
+      || forecast_parse(&d, &cur, t) != 0)
+    goto cleanup;
+  forecast_history(c, l, &d, &cur, t);
+
+  if((out = open_memstream(buf, buflen)) == NULL) {
+    FERROR(errno, "open_memstream()");
+    goto cleanup;
+  }
+
+  start = timings_now();
+  ret = diff_forecast(c, l, &prev, &cur, out);
+  timings_record(t, "diff", start);
+
+  if(fclose(out) != 0 && ret == 0) {
+    FERROR(errno, "fclose()");
+    ret = -1;
+  }
+  if(ret != 0) {
+    free(*buf);
+    *buf = NULL;
+    *buflen = 0;
+  }
+
+cleanup:
+  free_forecast(&cur);
+  free_forecast(&prev);
+  free_data(&d);
+  free_data(&prevd);
+
+  return ret;
+}
+
+void free_data(Data *d) {
+  free(d->data);
+  *d = (Data) DATA_NULL;
+}
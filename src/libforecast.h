@@ -0,0 +1,82 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBFORECAST_H
+#define LIBFORECAST_H
+
+/* libforecast: everything the forecast program does, usable from other
+ * programs. Functions returning int return 0 on success and -1 on
+ * failure, in which case forecast_strerror() describes the failure.
+ * Nothing in the library terminates the process.
+ *
+ * The library keeps some state between calls, set up on first use:
+ *
+ *   - the description of the last failure, one per thread
+ *   - libcurl, loaded once by the first request (see curlapi.h)
+ *   - the metrics counters, which are updated atomically
+ *   - the replay archive and the proxy's fetches in flight, each
+ *     guarded by a mutex
+ *   - the plot buffer pool and label cache of barplot.c, which are
+ *     not locked
+ *
+ * Fetching, parsing, rendering the print modes and the batch and proxy
+ * modes may therefore be used from multiple threads as long as they
+ * don't share the Data and Forecast structures they write to. The plot
+ * modes may only be used from one thread at a time, since they share
+ * the pool and cache besides taking over the terminal.
+ * forecast_cleanup() releases the state and must only be called once
+ * no other thread uses the library. */
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "alert.h"
+#include "arena.h"
+#include "batch.h"
+#include "cache.h"
+#include "cacheindex.h"
+#include "codec.h"
+#include "configfile.h"
+#include "curlapi.h"
+#include "diff.h"
+#include "forecast.h"
+#include "history.h"
+#include "metrics.h"
+#include "network.h"
+#include "parse.h"
+#include "proxy.h"
+#include "render.h"
+#include "replay.h"
+#include "spatial.h"
+#include "timings.h"
+
+void  forecast_cleanup(void);
+int   forecast_fetch(const Config *c, const Location *l, Data *d, bool bypass_cache,
+        Timings *t);
+int   forecast_parse(const Data *d, Forecast *f, Timings *t);
+void  forecast_history(const Config *c, const Location *l, const Data *d, const Forecast *f,
+        Timings *t);
+int   forecast_render(const Config *c, const Location *l, const Forecast *f, FILE *out,
+        Timings *t);
+int   forecast_render_buffer(const Config *c, const Location *l, const Forecast *f,
+        char **buf, size_t *buflen, Timings *t);
+int   forecast_diff(const Config *c, const Location *l, char **buf, size_t *buflen,
+        Timings *t);
+void  free_data(Data *d);
+
+#endif
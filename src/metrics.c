@@ -0,0 +1,236 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "forecast.h"
+#include "metrics.h"
+
+#define METRICS_LINE_MAX 128
+
+/* Upper bounds of the histogram buckets in seconds, +Inf is implied */
+static const double bounds[] = {
+  0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+#define BUCKETS (sizeof(bounds)/sizeof(bounds[0]) + 1)
+
+static const struct {
+  const char *name;
+  const char *help;
+} counter_names[METRIC_COUNTERS] = {
+  [METRIC_CACHE_HITS]         = { "forecast_cache_hits_total",          "Forecasts served from a fresh cache" },
+  [METRIC_CACHE_MISSES]       = { "forecast_cache_misses_total",        "Cache lookups that found no fresh data" },
+  [METRIC_CACHE_STALE_SERVES] = { "forecast_cache_stale_serves_total",  "Forecasts served from an expired cache" },
+  [METRIC_API_REQUESTS]       = { "forecast_api_requests_total",        "Requests made to the forecast API" },
+  [METRIC_API_FAILURES]       = { "forecast_api_request_failures_total","Requests to the forecast API that failed" },
+  [METRIC_API_RETRIES]        = { "forecast_api_retries_total",         "Requests to the forecast API repeated after a failure" },
+  [METRIC_API_HEDGES]         = { "forecast_api_hedged_requests_total", "Second requests started because the first was slow" },
+  [METRIC_DOWNLOADED_BYTES]   = { "forecast_downloaded_bytes_total",    "Bytes received from the forecast API" },
+  [METRIC_PROXY_REQUESTS]     = { "forecast_proxy_requests_total",      "Forecasts requested from the proxy" },
+  [METRIC_PROXY_COALESCED]    = { "forecast_proxy_coalesced_total",     "Proxy requests that waited for another one's fetch" }
+}, histogram_names[METRIC_HISTOGRAMS] = {
+  [METRIC_REQUEST_SECONDS]    = { "forecast_request_duration_seconds",  "Duration of API requests" },
+  [METRIC_PARSE_SECONDS]      = { "forecast_parse_duration_seconds",    "Duration of parsing responses" },
+  [METRIC_RENDER_SECONDS]     = { "forecast_render_duration_seconds",   "Duration of rendering" }
+};
+
+static struct {
+  uint64_t counters[METRIC_COUNTERS];
+  struct {
+    uint64_t buckets[BUCKETS];  /* not cumulative */
+    uint64_t count;
+    uint64_t sum_ns;
+  } histograms[METRIC_HISTOGRAMS];
+} metrics;
+
+/* A single exposition line: series name including labels, and value */
+typedef struct {
+  char series[METRICS_LINE_MAX];
+  double value;
+} Sample;
+
+static int  metrics_samples(Sample **samples);
+static void metrics_merge(Sample *samples, int len, FILE *in);
+static int  metrics_print(FILE *out, const Sample *samples, int len);
+
+void metrics_count(int counter, uint64_t n) {
+  __atomic_add_fetch(&metrics.counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void metrics_observe(int histogram, uint64_t ns) {
+  int b = 0;
+
+  while(b < BUCKETS - 1 && ns > bounds[b] * 1e9)
+    b++;
+
+  __atomic_add_fetch(&metrics.histograms[histogram].buckets[b], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&metrics.histograms[histogram].count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&metrics.histograms[histogram].sum_ns, ns, __ATOMIC_RELAXED);
+}
+
+/* Snapshot of all metrics in exposition order */
+int metrics_samples(Sample **samples) {
+  const int len = METRIC_COUNTERS + METRIC_HISTOGRAMS * (BUCKETS + 2);
+  Sample *s;
+  int n = 0;
+
+  s = calloc(len, sizeof(Sample));
+  GUARD_ALLOC(s, -1);
+
+  for(int i = 0; i < METRIC_COUNTERS; i++) {
+    snprintf(s[n].series, METRICS_LINE_MAX, "%s", counter_names[i].name);
+    s[n++].value = __atomic_load_n(&metrics.counters[i], __ATOMIC_RELAXED);
+  }
+
+  for(int i = 0; i < METRIC_HISTOGRAMS; i++) {
+    uint64_t cumulative = 0;
+
+    for(int b = 0; b < BUCKETS; b++) {
+      cumulative += __atomic_load_n(&metrics.histograms[i].buckets[b], __ATOMIC_RELAXED);
+      if(b < BUCKETS - 1)
+        snprintf(s[n].series, METRICS_LINE_MAX, "%s_bucket{le=\"%g\"}",
+            histogram_names[i].name, bounds[b]);
+      else
+        snprintf(s[n].series, METRICS_LINE_MAX, "%s_bucket{le=\"+Inf\"}",
+            histogram_names[i].name);
+      s[n++].value = cumulative;
+    }
+    snprintf(s[n].series, METRICS_LINE_MAX, "%s_sum", histogram_names[i].name);
+    s[n++].value = __atomic_load_n(&metrics.histograms[i].sum_ns, __ATOMIC_RELAXED) / 1e9;
+    snprintf(s[n].series, METRICS_LINE_MAX, "%s_count", histogram_names[i].name);
+    s[n++].value = __atomic_load_n(&metrics.histograms[i].count, __ATOMIC_RELAXED);
+  }
+
+  *samples = s;
+
+  return n;
+}
+
+/* Adds the values of a previously written file, so that the counters
+ * accumulate over invocations */
+void metrics_merge(Sample *samples, int len, FILE *in) {
+  char line[2*METRICS_LINE_MAX];
+
+  while(fgets(line, sizeof(line), in) != NULL) {
+    char *sp;
+
+    if(line[0] == '#' || (sp = strrchr(line, ' ')) == NULL)
+      continue;
+    *sp = '\0';
+
+    for(int i = 0; i < len; i++)
+      if(strcmp(samples[i].series, line) == 0) {
+        samples[i].value += strtod(sp + 1, NULL);
+        break;
+      }
+  }
+}
+
+int metrics_print(FILE *out, const Sample *samples, int len) {
+  int n = 0;
+
+  for(int i = 0; i < METRIC_COUNTERS; i++, n++)
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %.15g\n",
+        counter_names[i].name, counter_names[i].help,
+        counter_names[i].name, samples[n].series, samples[n].value);
+
+  for(int i = 0; i < METRIC_HISTOGRAMS; i++) {
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n",
+        histogram_names[i].name, histogram_names[i].help, histogram_names[i].name);
+    for(int j = 0; j < BUCKETS + 2; j++, n++)
+      fprintf(out, "%s %.15g\n", samples[n].series, samples[n].value);
+  }
+
+  return ferror(out) ? -1 : 0;
+}
+
+/* Prometheus text format of this process' metrics */
+int metrics_format(FILE *out) {
+  Sample *samples;
+  int len, ret;
+
+  if((len = metrics_samples(&samples)) == -1)
+    return -1;
+  ret = metrics_print(out, samples, len);
+  free(samples);
+
+  return ret;
+}
+
+/* Adds this process' metrics to the totals in path, for the node
+ * exporter's textfile collector. The file is replaced atomically, and
+ * concurrent invocations are serialized by a lock on path.lock. */
+int metrics_write(const char *path) {
+  const int plen = strlen(path) + 16;
+  char lockpath[plen], tmppath[plen];
+  Sample *samples = NULL;
+  FILE *f;
+  int lockfd, len, ret = -1;
+
+  snprintf(lockpath, plen, "%s.lock", path);
+  snprintf(tmppath, plen, "%s.%d", path, (int) getpid());
+
+  if((lockfd = open(lockpath, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1) {
+    FERROR(errno, "open(%s)", lockpath);
+    return -1;
+  }
+  if(flock(lockfd, LOCK_EX) != 0) {
+    FERROR(errno, "flock(%s)", lockpath);
+    goto return_error;
+  }
+
+  if((len = metrics_samples(&samples)) == -1)
+    goto return_error;
+
+  if((f = fopen(path, "r")) != NULL) {
+    metrics_merge(samples, len, f);
+    fclose(f);
+  }
+
+  if((f = fopen(tmppath, "w")) == NULL) {
+    FERROR(errno, "fopen(%s)", tmppath);
+    goto return_error;
+  }
+  if(metrics_print(f, samples, len) != 0 || fflush(f) != 0 || fsync(fileno(f)) != 0) {
+    FERROR(errno, "write(%s)", tmppath);
+    fclose(f);
+    unlink(tmppath);
+    goto return_error;
+  }
+  fclose(f);
+
+  if(rename(tmppath, path) != 0) {
+    FERROR(errno, "rename(%s, %s)", tmppath, path);
+    unlink(tmppath);
+    goto return_error;
+  }
+
+  ret = 0;
+
+return_error:
+  free(samples);
+  close(lockfd);
+  return ret;
+}
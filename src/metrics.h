@@ -0,0 +1,54 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Process wide counters and latency histograms. Updates are atomic and
+ * may come from any thread. */
+
+enum {
+  METRIC_CACHE_HITS,
+  METRIC_CACHE_MISSES,
+  METRIC_CACHE_STALE_SERVES,
+  METRIC_API_REQUESTS,
+  METRIC_API_FAILURES,
+  METRIC_API_RETRIES,
+  METRIC_API_HEDGES,
+  METRIC_DOWNLOADED_BYTES,
+  METRIC_PROXY_REQUESTS,
+  METRIC_PROXY_COALESCED,
+  METRIC_COUNTERS
+};
+
+enum {
+  METRIC_REQUEST_SECONDS,
+  METRIC_PARSE_SECONDS,
+  METRIC_RENDER_SECONDS,
+  METRIC_HISTOGRAMS
+};
+
+void  metrics_count(int counter, uint64_t n);
+void  metrics_observe(int histogram, uint64_t ns);
+int   metrics_format(FILE *out);
+int   metrics_write(const char *path);
+
+#endif
@@ -16,52 +16,255 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "curlapi.h"
+#include "metrics.h"
 #include "network.h"
+#include "probes.h"
+#include "replay.h"
+#include "timings.h"
+
+/* One curl transfer of an attempt */
+typedef struct {
+  const CurlApi *api;
+  CURL *curl;
+  Data data;
+  Data headers;
+} Transfer;
+
+static CURL*  request_transfer(const Config *c, const char *url, Transfer *x);
+static long   request_transfer_done(const Config *c, const char *key, Transfer *x, CURLcode r);
+static int    request_attempt(const Config *c, const char *url, const char *key, Data *d,
+                long *status);
+static bool   request_retryable(long status);
 
 size_t request_curl_callback(void *ptr, size_t size, size_t nmemb, void *data) {
   Data *d = (Data*) data;
   size_t ptrlen = size * nmemb;
+  size_t cap = d->datacap ? d->datacap : REQUEST_BUFFER;
+
+  char *buf;
 
-  if(d->data == NULL) {
-    d->data = malloc(ptrlen);
-    GUARD_MALLOC(d->data);
-    d->datalen = ptrlen;
-    memcpy(d->data, ptr, ptrlen);
-  } else {
-    d->data = realloc(d->data, d->datalen + ptrlen);
-    memcpy(&d->data[d->datalen], ptr, ptrlen);
-    d->datalen += ptrlen;
+  /* Grown geometrically: a response comes in many small chunks */
+  while(cap < d->datalen + ptrlen + 1)
+    cap *= 2;
+
+  if(cap != d->datacap) {
+    /* Returning less than ptrlen makes curl abort the transfer */
+    if((buf = realloc(d->data, cap)) == NULL)
+      return 0;
+    d->data = buf;
+    d->datacap = cap;
   }
 
+  memcpy(&d->data[d->datalen], ptr, ptrlen);
+  d->datalen += ptrlen;
+  d->data[d->datalen] = '\0';
+
   return ptrlen;
 }
 
-int request(Config *c, Data *d) {
-  int urllen;
-  char *url;
-  CURLcode r;
+CURL* request_transfer(const Config *c, const char *url, Transfer *x) {
+  if((x->curl = x->api->easy_init()) == NULL) {
+    FERROR(0, "curl_easy_init() failed");
+    return NULL;
+  }
+  x->api->easy_setopt(x->curl, CURLOPT_URL, url);
+  x->api->easy_setopt(x->curl, CURLOPT_WRITEFUNCTION, request_curl_callback);
+  x->api->easy_setopt(x->curl, CURLOPT_WRITEDATA, &x->data);
+  /* Headers are only kept for the replay archive */
+  if(c->record_file != NULL) {
+    x->api->easy_setopt(x->curl, CURLOPT_HEADERFUNCTION, request_curl_callback);
+    x->api->easy_setopt(x->curl, CURLOPT_HEADERDATA, &x->headers);
+  }
+  /* HTTP errors must not end up in the cache */
+  x->api->easy_setopt(x->curl, CURLOPT_FAILONERROR, 1L);
+  /* signals don't mix with threads */
+  x->api->easy_setopt(x->curl, CURLOPT_NOSIGNAL, 1L);
+  /* Offer every encoding curl can decode; the data arrives decoded */
+  x->api->easy_setopt(x->curl, CURLOPT_ACCEPT_ENCODING, "");
+  x->api->easy_setopt(x->curl, CURLOPT_CONNECTTIMEOUT_MS, (long) c->request.connect_timeout);
+  x->api->easy_setopt(x->curl, CURLOPT_TIMEOUT_MS, (long) c->request.timeout);
+
+  return x->curl;
+}
+
+/* Collects the outcome of a completed transfer and records it. Returns
+ * the HTTP status, or -1 if recording failed. */
+long request_transfer_done(const Config *c, const char *key, Transfer *x, CURLcode r) {
+  curl_off_t downloaded = 0;
+  long status = 0;
+
+  x->api->easy_getinfo(x->curl, CURLINFO_NAMELOOKUP_TIME, &x->data.transfer.namelookup);
+  x->api->easy_getinfo(x->curl, CURLINFO_CONNECT_TIME, &x->data.transfer.connect);
+  x->api->easy_getinfo(x->curl, CURLINFO_APPCONNECT_TIME, &x->data.transfer.appconnect);
+  x->api->easy_getinfo(x->curl, CURLINFO_STARTTRANSFER_TIME, &x->data.transfer.starttransfer);
+  x->api->easy_getinfo(x->curl, CURLINFO_TOTAL_TIME, &x->data.transfer.total);
+  x->api->easy_getinfo(x->curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+  x->api->easy_getinfo(x->curl, CURLINFO_RESPONSE_CODE, &status);
+  x->data.transfer.size_download = downloaded;
+  metrics_count(METRIC_DOWNLOADED_BYTES, downloaded);
 
-  curl_global_init(CURL_GLOBAL_DEFAULT);
+  /* Failures are recorded too, they are part of what is replayed */
+  if(c->record_file != NULL
+      && replay_record(c->record_file, key, r, status, x->headers.data, x->headers.datalen,
+        &x->data) != 0)
+    return -1;
 
-  urllen = snprintf(NULL, 0, "https://api.forecast.io/forecast/%s/%f,%f",
-      c->apikey, c->location.latitude, c->location.longitude) + 1;
-  url = malloc(urllen);
-  GUARD_MALLOC(url);
-  snprintf(url, urllen, "https://api.forecast.io/forecast/%s/%f,%f",
-      c->apikey, c->location.latitude, c->location.longitude);
+  if(r == CURLE_HTTP_RETURNED_ERROR)
+    FERROR(0, "HTTP status %ld", status);
+  else if(r != CURLE_OK)
+    FERROR(0, "cURL error: %s", x->api->easy_strerror(r));
 
-  CURL *curl = curl_easy_init();
-  curl_easy_setopt(curl, CURLOPT_URL, url);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, request_curl_callback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, d);
-  r = curl_easy_perform(curl);
-  if(r != CURLE_OK)
-    printf("cURL error: %s\n", curl_easy_strerror(r));
+  return status;
+}
 
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
+/* One attempt at a response. With a hedge_delay, a second transfer is
+ * started if the first hasn't completed by then, and whichever succeeds
+ * first wins. */
+int request_attempt(const Config *c, const char *url, const char *key, Data *d, long *status) {
+  const CurlApi *api = curlapi_load();
+  Transfer x[2] = {
+    { .api = api, .curl = NULL, .data = DATA_NULL, .headers = DATA_NULL },
+    { .api = api, .curl = NULL, .data = DATA_NULL, .headers = DATA_NULL }
+  };
+  const uint64_t hedge_at = timings_now() + (uint64_t) c->request.hedge_delay * 1000000ULL;
+  CURLM *multi;
+  int started = 0, running = 1, winner = -1;
 
-  free(url);
+  *status = -1;
 
-  return r == CURLE_OK ? 0 : -1;
-};
+  if(api == NULL)
+    return -1;
+  if((multi = api->multi_init()) == NULL) {
+    FERROR(0, "curl_multi_init() failed");
+    return -1;
+  }
+
+  if(request_transfer(c, url, &x[0]) == NULL)
+    goto done;
+  api->multi_add_handle(multi, x[0].curl);
+  started = 1;
+
+  while(winner == -1 && running > 0) {
+    struct CURLMsg *msg;
+    int timeout = 1000, queued;
+
+    api->multi_perform(multi, &running);
+
+    while((msg = api->multi_info_read(multi, &queued)) != NULL) {
+      const int i = msg->easy_handle == x[0].curl ? 0 : 1;
+
+      if(msg->msg != CURLMSG_DONE)
+        continue;
+      *status = request_transfer_done(c, key, &x[i], msg->data.result);
+      if(msg->data.result == CURLE_OK && *status != -1) {
+        winner = i;
+        break;
+      }
+      /* A failed transfer doesn't wait for its hedge */
+      if(*status == -1 || started == 1) {
+        running = 0;
+        break;
+      }
+    }
+
+    if(winner != -1 || running == 0)
+      break;
+
+    if(started == 1 && c->request.hedge_delay > 0) {
+      const uint64_t now = timings_now();
+
+      if(now >= hedge_at) {
+        if(request_transfer(c, url, &x[1]) != NULL) {
+          api->multi_add_handle(multi, x[1].curl);
+          metrics_count(METRIC_API_HEDGES, 1);
+        }
+        started = 2;
+        continue;
+      }
+      if((hedge_at - now) / 1000000 < timeout)
+        timeout = (hedge_at - now) / 1000000 + 1;
+    }
+
+    api->multi_wait(multi, NULL, 0, timeout, NULL);
+  }
+
+done:
+  for(int i = 0; i < 2; i++) {
+    if(x[i].curl != NULL) {
+      api->multi_remove_handle(multi, x[i].curl);
+      api->easy_cleanup(x[i].curl);
+    }
+    free(x[i].headers.data);
+    if(i == winner)
+      *d = x[i].data;
+    else
+      free(x[i].data.data);
+  }
+  api->multi_cleanup(multi);
+
+  return winner != -1 ? 0 : -1;
+}
+
+/* Transport errors, timeouts, throttling and server errors may pass.
+ * Other HTTP errors and failures to record or replay won't. */
+bool request_retryable(long status) {
+  return status == 0 || status == 408 || status == 429 || status >= 500;
+}
+
+int request(const Config *c, const Location *l, Data *d) {
+  char key[REQUEST_URL_MAX];
+  char url[REQUEST_URL_MAX];
+  unsigned int seed = (unsigned int) timings_now();
+  uint64_t start;
+  long status;
+  int ret;
+
+  if(snprintf(key, sizeof(key), "%f,%f%s%s", l->latitude, l->longitude,
+        l->exclude ? "?exclude=" : "", l->exclude ?: "") >= sizeof(key)
+      || snprintf(url, sizeof(url), "%s/%s/%s", c->api_url, c->apikey, key) >= sizeof(url)) {
+    FERROR(0, "request URL longer than %d bytes", REQUEST_URL_MAX);
+    return -1;
+  }
+
+  PROBE1(request__start, PROBE_LOCATION(l));
+  metrics_count(METRIC_API_REQUESTS, 1);
+  start = timings_now();
+
+  for(int attempt = 0; ; attempt++) {
+    if(c->replay_file != NULL)
+      ret = replay_fetch(c, key, d, &status);
+    else
+      ret = request_attempt(c, url, key, d, &status);
+
+    if(ret == 0 || attempt == c->request.retries || request_retryable(status) == false)
+      break;
+
+    free(d->data);
+    *d = (Data) DATA_NULL;
+    metrics_count(METRIC_API_RETRIES, 1);
+
+    /* Exponential backoff with jitter, so that clients failing together
+     * don't retry together. Replays at full speed don't wait. */
+    if(c->replay_file == NULL || c->replay_timing == true) {
+      const uint64_t backoff = (uint64_t) c->request.backoff << (attempt < 16 ? attempt : 16);
+      const uint64_t ms = backoff / 2 + (backoff > 1 ? rand_r(&seed) % (backoff / 2 + 1) : 0);
+
+      nanosleep(&(struct timespec) {
+          .tv_sec = ms / 1000,
+          .tv_nsec = (ms % 1000) * 1000000L }, NULL);
+    }
+  }
+
+  metrics_observe(METRIC_REQUEST_SECONDS, timings_now() - start);
+
+  if(ret != 0) {
+    metrics_count(METRIC_API_FAILURES, 1);
+    free(d->data);
+    *d = (Data) DATA_NULL;
+  }
+
+  PROBE3(request__done, PROBE_LOCATION(l), d->datalen, ret);
+
+  return ret;
+}
@@ -25,7 +25,11 @@
 
 #include "forecast.h"
 
-int    request(Config *c, Data *d);
+/* Initial size of the response buffer, which doubles as needed */
+#define REQUEST_BUFFER  32768
+#define REQUEST_URL_MAX 512
+
+int    request(const Config *c, const Location *l, Data *d);
 size_t request_curl_callback(void*, size_t, size_t, void*);
 
 #endif
@@ -0,0 +1,246 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "codec.h"
+#include "metrics.h"
+#include "parse.h"
+#include "probes.h"
+#include "timings.h"
+
+/* The numeric fields are also the columns of the history store, which
+ * fixes them by name when it is created */
+const DatapointField datapoint_fields[] = {
+#define FIELD(key, type) { #key, offsetof(Datapoint, key), (type) }
+  FIELD(time,                 FIELD_TIME),
+  FIELD(summary,              FIELD_STRING),
+  FIELD(temperature,          FIELD_DOUBLE),
+  FIELD(apparentTemperature,  FIELD_DOUBLE),
+  FIELD(temperatureMin,       FIELD_DOUBLE),
+  FIELD(temperatureMax,       FIELD_DOUBLE),
+  FIELD(dewPoint,             FIELD_DOUBLE),
+  FIELD(humidity,             FIELD_DOUBLE),
+  FIELD(precipProbability,    FIELD_DOUBLE),
+  FIELD(precipIntensity,      FIELD_DOUBLE),
+  FIELD(cloudCover,           FIELD_DOUBLE),
+  FIELD(windSpeed,            FIELD_DOUBLE),
+  FIELD(windBearing,          FIELD_DOUBLE),
+  FIELD(pressure,             FIELD_DOUBLE),
+  FIELD(ozone,                FIELD_DOUBLE),
+  FIELD(sunriseTime,          FIELD_TIME),
+  FIELD(sunsetTime,           FIELD_TIME)
+#undef FIELD
+};
+
+const int datapoint_fields_len = sizeof(datapoint_fields)/sizeof(datapoint_fields[0]);
+
+typedef struct {
+  struct json_tokener *tok;
+  struct json_object *o;
+} ParseState;
+
+static char*  copy_string(Arena *a, struct json_object *o);
+static int    parse_chunk(const char *buf, size_t len, void *arg);
+static int    parse_datapoint(Arena *a, struct json_object *o, Datapoint *p);
+static int    parse_datablock(Arena *a, struct json_object *o, Datablock *b);
+
+char* copy_string(Arena *a, struct json_object *o) {
+  const char *s = json_object_get_string(o);
+
+  return arena_strdup(a, s ?: "");
+}
+
+int parse_datapoint(Arena *a, struct json_object *o, Datapoint *p) {
+  for(int i = 0; i < datapoint_fields_len; i++) {
+    void *field = (char*)p + datapoint_fields[i].offset;
+    struct json_object *v = NULL;
+    json_bool present = json_object_object_get_ex(o, datapoint_fields[i].key, &v);
+
+    switch(datapoint_fields[i].type) {
+      case FIELD_DOUBLE:
+        *(double*)field = present ? json_object_get_double(v) : NAN;
+        break;
+      case FIELD_TIME:
+        *(time_t*)field = present ? (time_t) json_object_get_int64(v) : 0;
+        break;
+      case FIELD_STRING:
+        *(char**)field = NULL;
+        if(present && (*(char**)field = copy_string(a, v)) == NULL)
+          return -1;
+        break;
+    }
+  }
+
+  return 0;
+}
+
+int parse_datablock(Arena *a, struct json_object *o, Datablock *b) {
+  struct json_object *summary, *data;
+
+  if(json_object_object_get_ex(o, "data", &data) != TRUE) {
+    FERROR(0, "data block without data");
+    return -1;
+  }
+
+  if(json_object_object_get_ex(o, "summary", &summary) == TRUE)
+    if((b->summary = copy_string(a, summary)) == NULL)
+      return -1;
+
+  b->len = json_object_array_length(data);
+  if(b->len == 0)
+    return 0;
+  if((b->data = arena_calloc(a, b->len, sizeof(Datapoint))) == NULL)
+    return -1;
+
+  for(int i = 0; i < b->len; i++)
+    if(parse_datapoint(a, json_object_array_get_idx(data, i), &b->data[i]) != 0)
+      return -1;
+
+  return 0;
+}
+
+/* Feeds the tokener as the data is decompressed */
+int parse_chunk(const char *buf, size_t len, void *arg) {
+  ParseState *ps = (ParseState*) arg;
+
+  if((ps->o = json_tokener_parse_ex(ps->tok, buf, len)) != NULL)
+    return 1;
+  return json_tokener_get_error(ps->tok) == json_tokener_continue ? 0 : -1;
+}
+
+int parse_forecast(const Data *d, Forecast *f) {
+  ParseState ps = { .o = NULL };
+  uint64_t start = timings_now();
+  enum json_tokener_error e;
+  int ret;
+
+  if(d->data == NULL) {
+    FERROR(0, "no data to parse");
+    return -1;
+  }
+
+  if((ps.tok = json_tokener_new()) == NULL) {
+    FERROR(errno, "json_tokener_new()");
+    return -1;
+  }
+
+  PROBE1(parse__start, d->datalen);
+
+  ret = codec_stream(d, parse_chunk, &ps);
+  if(ret != 0 || ps.o == NULL) {
+    /* Otherwise, decompression failed and said why */
+    e = json_tokener_get_error(ps.tok);
+    if(e != json_tokener_continue && e != json_tokener_success)
+      FERROR(0, "invalid JSON data: %s", json_tokener_error_desc(e));
+    else if(ret == 0)
+      FERROR(0, "truncated JSON data");
+    json_object_put(ps.o);
+    json_tokener_free(ps.tok);
+    PROBE2(parse__done, d->datalen, -1);
+    return -1;
+  }
+  json_tokener_free(ps.tok);
+
+  ret = extract_forecast(ps.o, f);
+  json_object_put(ps.o);
+
+  PROBE2(parse__done, d->datalen, ret);
+  metrics_observe(METRIC_PARSE_SECONDS, timings_now() - start);
+
+  return ret;
+}
+
+/* Fills f from an already parsed response */
+int extract_forecast(struct json_object *o, Forecast *f) {
+  struct json_object *v;
+  int ret = -1;
+
+#define REQUIRE(key)                                          \
+  if(json_object_object_get_ex(o, #key, &v) != TRUE) {        \
+    FERROR(0, "response lacks the %s field", #key);           \
+    goto return_error;                                        \
+  }
+
+  REQUIRE(latitude);
+  f->latitude = json_object_get_double(v);
+  REQUIRE(longitude);
+  f->longitude = json_object_get_double(v);
+  REQUIRE(timezone);
+  if((f->timezone = copy_string(&f->arena, v)) == NULL)
+    goto return_error;
+#undef REQUIRE
+
+  if(json_object_object_get_ex(o, "offset", &v) == TRUE)
+    f->offset = json_object_get_double(v);
+
+  if(json_object_object_get_ex(o, "currently", &v) == TRUE) {
+    f->blocks |= BLOCK_CURRENTLY;
+    if(parse_datapoint(&f->arena, v, &f->currently) != 0)
+      goto return_error;
+  }
+
+  if(json_object_object_get_ex(o, "minutely", &v) == TRUE) {
+    f->blocks |= BLOCK_MINUTELY;
+    if(parse_datablock(&f->arena, v, &f->minutely) != 0)
+      goto return_error;
+  }
+
+  if(json_object_object_get_ex(o, "hourly", &v) == TRUE) {
+    f->blocks |= BLOCK_HOURLY;
+    if(parse_datablock(&f->arena, v, &f->hourly) != 0)
+      goto return_error;
+  }
+
+  if(json_object_object_get_ex(o, "daily", &v) == TRUE) {
+    f->blocks |= BLOCK_DAILY;
+    if(parse_datablock(&f->arena, v, &f->daily) != 0)
+      goto return_error;
+  }
+
+  ret = 0;
+
+return_error:
+  if(ret != 0)
+    free_forecast(f);
+  return ret;
+}
+
+const DatapointField* datapoint_field(const char *key) {
+  for(int i = 0; i < datapoint_fields_len; i++)
+    if(strcmp(datapoint_fields[i].key, key) == 0)
+      return &datapoint_fields[i];
+  return NULL;
+}
+
+/* Numeric value of a field as a double, times included */
+double datapoint_value(const Datapoint *p, const DatapointField *field) {
+  const void *v = (const char*)p + field->offset;
+
+  switch(field->type) {
+    case FIELD_DOUBLE:
+      return *(const double*)v;
+    case FIELD_TIME:
+      return *(const time_t*)v;
+    default:
+      return NAN;
+  }
+}
+
+void free_forecast(Forecast *f) {
+  arena_free(&f->arena);
+  *f = (Forecast) FORECAST_NULL;
+}
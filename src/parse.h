@@ -0,0 +1,52 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <json-c/json.h>
+#include <json-c/json_object.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "forecast.h"
+
+enum {
+  FIELD_DOUBLE,
+  FIELD_TIME,
+  FIELD_STRING
+};
+
+typedef struct {
+  const char *key;    /* as named by the API */
+  size_t offset;      /* in Datapoint */
+  int type;
+} DatapointField;
+
+extern const DatapointField datapoint_fields[];
+extern const int datapoint_fields_len;
+
+const DatapointField* datapoint_field(const char *key);
+double  datapoint_value(const Datapoint *p, const DatapointField *field);
+int     parse_forecast(const Data *d, Forecast *f);
+int     extract_forecast(struct json_object *o, Forecast *f);
+void    free_forecast(Forecast *f);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+/* USDT probes for tracing with bpftrace, perf, SystemTap and friends,
+ * compiled in with ./configure --enable-usdt. An unattached probe is a
+ * single nop instruction; without --enable-usdt there is nothing at
+ * all. All probes belong to the forecast provider, see README.mkd for
+ * the list of probes and their arguments. */
+
+#include "config.h"
+
+#ifdef ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define PROBE1(name, a)             DTRACE_PROBE1(forecast, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(forecast, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(forecast, name, a, b, c)
+
+#else
+
+#define PROBE1(name, a)             do {} while(0)
+#define PROBE2(name, a, b)          do {} while(0)
+#define PROBE3(name, a, b, c)       do {} while(0)
+
+#endif
+
+#define PROBE_LOCATION(l) ((l)->name ?: "")
+
+#endif
@@ -0,0 +1,414 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "libforecast.h"
+#include "proxy.h"
+
+#define PROXY_REQUEST_MAX 8192
+#define PROXY_HEADER_MAX  512
+#define PROXY_KEY_MAX     48
+#define PROXY_IO_TIMEOUT  10      /* s, for reading requests and writing responses */
+
+/* A fetch that concurrent requests for the same coordinates wait for.
+ * It leaves the list once done; the last one to let go frees it. */
+typedef struct Flight {
+  struct Flight *next;
+  char key[PROXY_KEY_MAX];
+  int refs;
+  bool done;
+  int ret;
+  Data data;
+  char error[FORECAST_ERROR_MAX];
+} Flight;
+
+typedef struct {
+  const Config *c;
+  int fd;
+} Connection;
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  Flight *flights;
+  int connections;
+} proxy = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .cond = PTHREAD_COND_INITIALIZER,
+  .flights = NULL,
+  .connections = 0
+};
+
+static volatile sig_atomic_t stopped = 0;
+
+static Flight*  proxy_fetch(const Config *c, const Location *l, const char *key);
+static void     proxy_release(Flight *f);
+static int      proxy_send(int fd, const char *buf, size_t len);
+static int      proxy_sink(const char *buf, size_t len, void *arg);
+static int      proxy_error(int fd, int status, const char *reason, const char *msg);
+static int      proxy_metrics(int fd);
+static int      proxy_forecast(const Config *c, int fd, const char *path, bool gzip);
+static bool     accepts_gzip(const char *req);
+static void*    serve(void *arg);
+
+/* Joins the fetch in flight for key, or makes it */
+Flight* proxy_fetch(const Config *c, const Location *l, const char *key) {
+  Flight *f;
+
+  pthread_mutex_lock(&proxy.lock);
+  for(f = proxy.flights; f != NULL; f = f->next)
+    if(strcmp(f->key, key) == 0) {
+      f->refs++;
+      metrics_count(METRIC_PROXY_COALESCED, 1);
+      while(f->done == false)
+        pthread_cond_wait(&proxy.cond, &proxy.lock);
+      pthread_mutex_unlock(&proxy.lock);
+      return f;
+    }
+
+  if((f = calloc(1, sizeof(Flight))) == NULL) {
+    FERROR(errno, "calloc()");
+    pthread_mutex_unlock(&proxy.lock);
+    return NULL;
+  }
+  snprintf(f->key, sizeof(f->key), "%s", key);
+  f->refs = 1;
+  f->data = (Data) DATA_NULL;
+  f->next = proxy.flights;
+  proxy.flights = f;
+  pthread_mutex_unlock(&proxy.lock);
+
+  f->ret = forecast_fetch(c, l, &f->data, false, NULL);
+  if(f->ret != 0 || f->data.stale == true)
+    snprintf(f->error, sizeof(f->error), "%s", forecast_strerror());
+  else
+    forecast_history(c, l, &f->data, NULL, NULL);
+
+  pthread_mutex_lock(&proxy.lock);
+  for(Flight **p = &proxy.flights; *p != NULL; p = &(*p)->next)
+    if(*p == f) {
+      *p = f->next;
+      break;
+    }
+  f->done = true;
+  pthread_cond_broadcast(&proxy.cond);
+  pthread_mutex_unlock(&proxy.lock);
+
+  return f;
+}
+
+void proxy_release(Flight *f) {
+  bool last;
+
+  pthread_mutex_lock(&proxy.lock);
+  last = --f->refs == 0;
+  pthread_mutex_unlock(&proxy.lock);
+
+  if(last) {
+    free_data(&f->data);
+    free(f);
+  }
+}
+
+int proxy_send(int fd, const char *buf, size_t len) {
+  while(len > 0) {
+    ssize_t w = send(fd, buf, len, MSG_NOSIGNAL);
+    if(w <= 0)
+      return -1;
+    buf += w;
+    len -= w;
+  }
+  return 0;
+}
+
+int proxy_sink(const char *buf, size_t len, void *arg) {
+  return proxy_send(*(int*) arg, buf, len);
+}
+
+/* Errors look like the API's own */
+int proxy_error(int fd, int status, const char *reason, const char *msg) {
+  char body[FORECAST_ERROR_MAX + 64], header[PROXY_HEADER_MAX];
+  int blen, hlen;
+
+  blen = snprintf(body, sizeof(body), "{\"code\":%d,\"error\":\"", status);
+  for(; *msg != '\0' && blen < sizeof(body) - 3; msg++)
+    if(*msg != '"' && *msg != '\\' && isprint((unsigned char) *msg))
+      body[blen++] = *msg;
+  blen += snprintf(&body[blen], sizeof(body) - blen, "\"}");
+
+  hlen = snprintf(header, sizeof(header),
+      "HTTP/1.1 %d %s\r\n"
+      "Content-Type: application/json\r\n"
+      "Content-Length: %d\r\n"
+      "Connection: close\r\n\r\n", status, reason, blen);
+
+  if(proxy_send(fd, header, hlen) != 0 || proxy_send(fd, body, blen) != 0)
+    return -1;
+  return 0;
+}
+
+int proxy_metrics(int fd) {
+  char header[PROXY_HEADER_MAX];
+  char *buf = NULL;
+  size_t buflen = 0;
+  FILE *out;
+  int hlen, ret;
+
+  if((out = open_memstream(&buf, &buflen)) == NULL)
+    return proxy_error(fd, 500, "Internal Server Error", "open_memstream() failed");
+  ret = metrics_format(out);
+  fclose(out);
+  if(ret != 0) {
+    free(buf);
+    return proxy_error(fd, 500, "Internal Server Error", forecast_strerror());
+  }
+
+  hlen = snprintf(header, sizeof(header),
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %zu\r\n"
+      "Connection: close\r\n\r\n", buflen);
+  ret = proxy_send(fd, header, hlen) == 0 && proxy_send(fd, buf, buflen) == 0 ? 0 : -1;
+  free(buf);
+
+  return ret;
+}
+
+/* Serves the last path component, LATITUDE,LONGITUDE */
+int proxy_forecast(const Config *c, int fd, const char *path, bool gzip) {
+  const char *end = path + strcspn(path, "? ");
+  const char *coords = end;
+  char header[PROXY_HEADER_MAX], key[PROXY_KEY_MAX];
+  Location l = LOCATION_NULL;
+  Flight *f;
+  char *p;
+  int hlen, ret;
+
+  while(coords > path && coords[-1] != '/')
+    coords--;
+  l.latitude = strtod(coords, &p);
+  if(p == coords || *p != ',')
+    return proxy_error(fd, 404, "Not Found", "expected .../LATITUDE,LONGITUDE");
+  l.longitude = strtod(p + 1, &p);
+  if(p != end || isfinite(l.latitude) == 0 || isfinite(l.longitude) == 0
+      || fabs(l.latitude) > 90.0 || fabs(l.longitude) > 180.0)
+    return proxy_error(fd, 404, "Not Found", "invalid coordinates");
+
+  l.max_cache_age = c->max_cache_age;
+  l.cache_expiry = c->cache_expiry;
+  l.max_data_age = c->max_data_age;
+  l.compress = c->cache_compress;
+  /* Clients get every block, so spatial lookups mustn't answer from a
+   * named location's cache that excludes some */
+  l.exclude = NULL;
+  snprintf(key, sizeof(key), "%.5f,%.5f", l.latitude, l.longitude);
+  metrics_count(METRIC_PROXY_REQUESTS, 1);
+
+  if((f = proxy_fetch(c, &l, key)) == NULL)
+    return proxy_error(fd, 500, "Internal Server Error", forecast_strerror());
+  if(f->ret != 0) {
+    ret = proxy_error(fd, 502, "Bad Gateway", f->error);
+    proxy_release(f);
+    return ret;
+  }
+
+  /* Compressed cache entries are passed on as they are if the client
+   * takes gzip, and decompressed on the way out otherwise */
+  gzip = gzip && f->data.codec == CODEC_GZIP;
+  hlen = snprintf(header, sizeof(header),
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: application/json; charset=utf-8\r\n"
+      "Content-Length: %zu\r\n"
+      "%s%s"
+      "Connection: close\r\n\r\n",
+      gzip || f->data.codec == CODEC_NONE ? f->data.datalen : f->data.rawlen,
+      gzip ? "Content-Encoding: gzip\r\n" : "",
+      f->data.stale ? "Warning: 110 - \"Response is Stale\"\r\n" : "");
+
+  if((ret = proxy_send(fd, header, hlen)) == 0)
+    ret = gzip ? proxy_send(fd, f->data.data, f->data.datalen)
+      : codec_stream(&f->data, proxy_sink, &fd);
+
+  proxy_release(f);
+
+  return ret;
+}
+
+bool accepts_gzip(const char *req) {
+  for(const char *h = strstr(req, "\r\n"); h != NULL; h = strstr(h + 2, "\r\n"))
+    if(strncasecmp(h + 2, "Accept-Encoding:", 16) == 0) {
+      const char *v = h + 18, *eol = strstr(v, "\r\n");
+      for(; eol != NULL && v + 4 <= eol; v++)
+        if(strncasecmp(v, "gzip", 4) == 0)
+          return true;
+      return false;
+    }
+  return false;
+}
+
+void* serve(void *arg) {
+  Connection *conn = (Connection*) arg;
+  const struct timeval tv = { .tv_sec = PROXY_IO_TIMEOUT };
+  char req[PROXY_REQUEST_MAX];
+  size_t reqlen = 0;
+  ssize_t r;
+
+  setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  /* The request line and the headers; a body isn't expected */
+  req[0] = '\0';
+  while(reqlen < sizeof(req) - 1
+      && (r = recv(conn->fd, req + reqlen, sizeof(req) - 1 - reqlen, 0)) > 0) {
+    reqlen += r;
+    req[reqlen] = '\0';
+    if(strstr(req, "\r\n\r\n") != NULL)
+      break;
+  }
+
+  if(strstr(req, "\r\n\r\n") == NULL)
+    proxy_error(conn->fd, 400, "Bad Request", "incomplete request");
+  else if(strncmp(req, "GET /", 5) != 0)
+    proxy_error(conn->fd, 405, "Method Not Allowed", "method not allowed");
+  else if(strncmp(req + 4, "/metrics ", 9) == 0)
+    proxy_metrics(conn->fd);
+  else
+    proxy_forecast(conn->c, conn->fd, req + 4, accepts_gzip(req));
+
+  close(conn->fd);
+  free(conn);
+
+  pthread_mutex_lock(&proxy.lock);
+  proxy.connections--;
+  pthread_cond_broadcast(&proxy.cond);
+  pthread_mutex_unlock(&proxy.lock);
+
+  return NULL;
+}
+
+/* Serves one thread per connection until proxy_stop() is called, then
+ * waits for the connections in progress */
+int proxy_run(const Config *c, const char *address, int port) {
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr = { htonl(INADDR_ANY) }
+  };
+  Config pc = *c;
+  pthread_attr_t attr;
+  sigset_t block, old;
+  int fd, one = 1;
+
+  if(c->cache_file == NULL) {
+    FERROR(0, "the proxy needs a cache_file");
+    return -1;
+  }
+  if(address != NULL && inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+    FERROR(0, "not an IPv4 address: %s", address);
+    return -1;
+  }
+
+  /* Every location is served from the spatial cache */
+  if(pc.cache_tolerance <= 0.0)
+    pc.cache_tolerance = PROXY_TOLERANCE;
+
+  if((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+    FERROR(errno, "socket()");
+    return -1;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+    FERROR(errno, "bind(%s:%d)", address ? address : "0.0.0.0", port);
+    close(fd);
+    return -1;
+  }
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  /* Signals are left to the thread that called us */
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  sigaddset(&block, SIGHUP);
+
+  stopped = 0;
+  while(stopped == 0) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    Connection *conn;
+    pthread_t tid;
+    int cfd;
+
+    /* Wakes up now and then to notice proxy_stop() */
+    if(poll(&pfd, 1, 500) <= 0 || (cfd = accept(fd, NULL, NULL)) == -1)
+      continue;
+
+    if((conn = malloc(sizeof(Connection))) == NULL) {
+      close(cfd);
+      continue;
+    }
+    conn->c = &pc;
+    conn->fd = cfd;
+
+    pthread_mutex_lock(&proxy.lock);
+    proxy.connections++;
+    pthread_mutex_unlock(&proxy.lock);
+
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+    if(pthread_create(&tid, &attr, serve, conn) != 0) {
+      close(cfd);
+      free(conn);
+      pthread_mutex_lock(&proxy.lock);
+      proxy.connections--;
+      pthread_mutex_unlock(&proxy.lock);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+  }
+
+  close(fd);
+  pthread_attr_destroy(&attr);
+
+  /* pc is on our stack */
+  pthread_mutex_lock(&proxy.lock);
+  while(proxy.connections > 0)
+    pthread_cond_wait(&proxy.cond, &proxy.lock);
+  pthread_mutex_unlock(&proxy.lock);
+
+  return 0;
+}
+
+/* Async-signal-safe */
+void proxy_stop(void) {
+  stopped = 1;
+}
@@ -0,0 +1,39 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "forecast.h"
+
+/* Caching HTTP proxy for the forecast API: answers GET requests for
+ * .../APIKEY/LATITUDE,LONGITUDE from the spatial cache, so that clients
+ * pointing their api_url at it share one upstream request per location
+ * and max_cache_age. Concurrent requests for the same coordinates wait
+ * for a single fetch. The proxy requests with its own API key and always
+ * fetches every data block, so the key and exclusions in the path are
+ * ignored. GET /metrics returns the proxy's metrics. */
+
+/* Cache distance in km when cache_tolerance is 0: only the coordinates
+ * themselves, give or take their printed precision */
+#define PROXY_TOLERANCE 0.001
+
+int   proxy_run(const Config *c, const char *address, int port);
+void  proxy_stop(void);
+
+#endif
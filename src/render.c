@@ -16,7 +16,17 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "alert.h"
+#include "metrics.h"
+#include "parse.h"
+#include "probes.h"
 #include "render.h"
+#include "timings.h"
+
+static void render_header(FILE *out, const Location *l, const Forecast *f);
+static const char* render_number(char *buf, double v, int precision);
+static void render_plot_label(const PlotCfg *pc, PlotSeries *s, const char *fmt, time_t t,
+    double offset);
 
 double render_mph2kph(double mph) {
   return mph * 1.609344;
@@ -26,258 +36,325 @@ double render_f2c(double fahrenheit) {
   return (fahrenheit - 32.0) * 5.0/9.0;
 }
 
-char * render_time(struct json_object *timeptr) {
-  time_t t = json_object_get_int(timeptr);
-  return ctime(&t);
+double render_in2mm(double inches) {
+  return inches * 25.4;
 }
 
-void render_hourly_datapoints(struct json_object *hourly) {
-  assert(hourly);
+char * render_time(time_t t, char *buf) {
+  return ctime_r(&t, buf);
+}
 
-  EXTRACT_PREFIXED(hourly, summary);
-  EXTRACT_PREFIXED(hourly, data);
-  struct array_list *al = json_object_get_array(hourly_data);
+/* Formats v into buf, which must hold RENDER_NUMBER_MAX bytes, or a
+ * placeholder if the response didn't have it */
+const char* render_number(char *buf, double v, int precision) {
+  if(isnan(v))
+    return "-";
+  snprintf(buf, RENDER_NUMBER_MAX, "%.*f", precision, v);
+  return buf;
+}
 
-  puts(   "-------------------------+");
-  printf( "Hourly                     %s\n", json_object_get_string(hourly_summary));
+/* Appends the label of the next bar, which must fit the bar's width */
+void render_plot_label(const PlotCfg *pc, PlotSeries *s, const char *fmt, time_t t,
+    double offset) {
+  const size_t len = pc->bar.width + 1 < PLOT_LABEL_MAX ? pc->bar.width + 1 : PLOT_LABEL_MAX;
 
-  for(int i = 0; i < array_list_length(al); i++) {
-    struct json_object *o = array_list_get_idx(al, i);
-    render_datapoint(o);
-  }
+  barplot_label(s->labels[s->len], len, fmt, t, offset);
+  s->plabels[s->len] = s->labels[s->len];
+  s->len++;
 }
 
-void render_hourly_datapoints_plot(const PlotCfg *pc, struct json_object *hourly) {
+void render_hourly_datapoints(FILE *out, const Datablock *hourly) {
   assert(hourly);
 
-  double data[48];
-  char labels[48][pc->bar.width+1];
-  char *plabels[48];
-  int i;
+  fputs(  "-------------------------+\n", out);
+  fprintf(out, "Hourly                     %s\n", hourly->summary ?: "");
+
+  for(int i = 0; i < hourly->len; i++)
+    render_datapoint(out, &hourly->data[i]);
+}
 
-  EXTRACT_PREFIXED(hourly, data);
+/* The temperature, or up to PLOT_OVERLAY_MAX temperature fields drawn
+ * over each other */
+int render_hourly_datapoints_plot(const PlotCfg *pc, const Datablock *hourly, double offset) {
+  assert(hourly);
 
-  struct array_list *al = json_object_get_array(hourly_data);
+  static const int colors[PLOT_OVERLAY_MAX] = {
+    PLOT_COLOR_BAR, PLOT_COLOR_BAR_OVERLAY, PLOT_COLOR_BAR_OVERLAY2
+  };
+  const int temperature = datapoint_field("temperature") - datapoint_fields;
+  const int *fields = pc->hourly.fields_len > 0 ? pc->hourly.fields : &temperature;
+  PlotOverlay o = {
+    .n = pc->hourly.fields_len > 0 ? pc->hourly.fields_len : 1
+  };
+  PlotSeries *s;
 
-  for(i = 0; i < array_list_length(al) && i < pc->hourly.succeeding_hours + 1; i++) {
-    struct json_object *o = array_list_get_idx(al, i);
+  if((s = plotseries_acquire()) == NULL)
+    return -1;
 
-    EXTRACT_PREFIXED(o, temperature);
-    EXTRACT_PREFIXED(o, time);
+  for(int i = 0; i < hourly->len && i < pc->hourly.succeeding_hours + 1
+      && i < PLOT_SERIES_MAX; i++) {
+    const Datapoint *p = &hourly->data[i];
 
-    double v = json_object_get_double(o_temperature);
-    data[i] = render_f2c(v);
+    for(int k = 0; k < o.n; k++)
+      s->values[k * PLOT_SERIES_MAX + i] =
+        render_f2c(datapoint_value(p, &datapoint_fields[fields[k]]));
 
-    time_t unixtime = json_object_get_int(o_time);
-    struct tm *time = gmtime(&unixtime);
-    strftime(labels[i], pc->bar.width+1, pc->hourly.label_format?:"%H", time);
-    labels[i][pc->bar.width] = '\0';
-    plabels[i] = &labels[i][0];
+    render_plot_label(pc, s, pc->hourly.label_format?:"%H", p->time, offset);
   } // for
 
-  barplot2(pc, data, plabels, i, pc->bar.color);
-}
+  for(int k = 0; k < o.n; k++) {
+    o.values[k] = s->values + k * PLOT_SERIES_MAX;
+    o.colors[k] = colors[k];
+  }
+  o.len = s->len;
+  o.labels = s->plabels;
 
-void render_precipitation_plot_hourly(const PlotCfg *pc, struct json_object *o) {
-  EXTRACT_PREFIXED(o, data);
+  const int ret = barplot_series(pc, &o);
+  plotseries_release(s);
 
-  struct array_list *al = json_object_get_array(o_data);
+  return ret;
+}
 
-  double d[48];
-  char labels[48][pc->bar.width+1];
-  char *plabels[48];
-  int i;
+int render_precipitation_plot_hourly(const PlotCfg *pc, const Datablock *hourly, double offset) {
+  PlotSeries *s;
 
-  for(i = 0; i < pc->hourly.succeeding_hours + 1 && i < 48 ; i++) {
-    struct json_object *oo = array_list_get_idx(al, i);
+  if((s = plotseries_acquire()) == NULL)
+    return -1;
 
-    EXTRACT_PREFIXED(oo, precipProbability);
-    EXTRACT_PREFIXED(oo, time);
+  for(int i = 0; i < pc->hourly.succeeding_hours + 1 && i < PLOT_SERIES_MAX
+      && i < hourly->len; i++) {
+    const Datapoint *p = &hourly->data[i];
 
-    d[i] = json_object_get_double(oo_precipProbability) * 100;
+    s->values[i] = p->precipProbability * 100;
 
-    time_t unixtime = json_object_get_int(oo_time);
-    struct tm *time = gmtime(&unixtime);
-    strftime(labels[i], pc->bar.width+1, pc->hourly.label_format?:"%d", time);
-    labels[i][pc->bar.width] = '\0';
-    plabels[i] = &labels[i][0];
+    render_plot_label(pc, s, pc->hourly.label_format?:"%d", p->time, offset);
   }
 
-  barplot2(pc, d, plabels, i, PLOT_COLOR_PRECIP);
+  const int ret = barplot2(pc, s->values, s->plabels, s->len, PLOT_COLOR_PRECIP);
+  plotseries_release(s);
 
-  return;
+  return ret;
 }
 
-void render_precipitation_plot_daily(const PlotCfg *pc, struct json_object *o) {
-  EXTRACT_PREFIXED(o, data);
+/* Precipitation intensity in mm/h over the next hour. The minutes are
+ * combined into as many bars as fit into the terminal. */
+int render_precipitation_plot_minutely(const PlotCfg *pc, const Datablock *minutely, double offset) {
+  const size_t len = minutely->len < PLOT_SERIES_MAX ? minutely->len : PLOT_SERIES_MAX;
+  PlotSeries *s;
+  double *intensity;
+  size_t n;
+
+  if((s = plotseries_acquire()) == NULL)
+    return -1;
+  intensity = s->values + PLOT_SERIES_MAX;
+
+  for(size_t i = 0; i < len; i++) {
+    const double v = minutely->data[i].precipIntensity;
+    intensity[i] = isnan(v) ? 0.0 : render_in2mm(v);
+  }
+
+  n = barplot_columns(pc);
+  if(n > len)
+    n = len;
+  barplot_downsample(intensity, len, n, pc->minutely.aggregate, s->values);
 
-  struct array_list *al = json_object_get_array(o_data);
-  int allen = array_list_length(al);
+  for(size_t i = 0; i < n; i++)
+    render_plot_label(pc, s, pc->minutely.label_format?:"%M",
+        minutely->data[i * len / n].time, offset);
 
-  double d[allen];
-  char labels[allen][pc->bar.width+1];
-  char *plabels[allen];
+  const int ret = barplot2(pc, s->values, s->plabels, s->len, PLOT_COLOR_PRECIP);
+  plotseries_release(s);
 
-  for(int i = 0; i < allen; i++) {
-    struct json_object *oo = array_list_get_idx(al, i);
+  return ret;
+}
+
+int render_precipitation_plot_daily(const PlotCfg *pc, const Datablock *daily, double offset) {
+  PlotSeries *s;
 
-    EXTRACT_PREFIXED(oo, precipProbability);
-    EXTRACT_PREFIXED(oo, time);
+  if((s = plotseries_acquire()) == NULL)
+    return -1;
 
-    d[i] = json_object_get_double(oo_precipProbability) * 100;
+  for(int i = 0; i < daily->len && i < PLOT_SERIES_MAX; i++) {
+    const Datapoint *p = &daily->data[i];
 
-    time_t unixtime = json_object_get_int(oo_time) + 86400;
-    struct tm *time = gmtime(&unixtime);
-    strftime(labels[i], pc->bar.width+1, pc->daily.label_format?:"%d", time);
-    labels[i][pc->bar.width] = '\0';
-    plabels[i] = &labels[i][0];
+    s->values[i] = p->precipProbability * 100;
+
+    render_plot_label(pc, s, pc->daily.label_format?:"%d", p->time, offset);
   }
 
-  barplot2(pc, d, plabels, allen, PLOT_COLOR_PRECIP);
+  const int ret = barplot2(pc, s->values, s->plabels, s->len, PLOT_COLOR_PRECIP);
+  plotseries_release(s);
 
-  return;
+  return ret;
 }
 
-void render_daily_temperature_plot(const PlotCfg *pc, struct json_object *daily) {
-  double tempMin[7];
-  double tempMax[7];
-  char labels[7][pc->bar.width+1];
-  char *plbl[7];
+int render_daily_temperature_plot(const PlotCfg *pc, const Datablock *daily, double offset) {
+  PlotSeries *s;
+  double *tempMax, *tempMin;
 
-  EXTRACT_PREFIXED(daily, data);
-  struct array_list *al = json_object_get_array(daily_data);
+  if((s = plotseries_acquire()) == NULL)
+    return -1;
+  tempMax = s->values;
+  tempMin = s->values + PLOT_SERIES_MAX;
 
-  for(int i = 0; i < 7; i++) {
-    struct json_object *o = array_list_get_idx(al, i);
+  for(int i = 0; i < 7 && i < daily->len; i++) {
+    const Datapoint *p = &daily->data[i];
 
-    EXTRACT_PREFIXED(o, temperatureMin)
-    EXTRACT_PREFIXED(o, temperatureMax)
-    EXTRACT_PREFIXED(o, time);
+    tempMin[i] = render_f2c(p->temperatureMin);
+    tempMax[i] = render_f2c(p->temperatureMax);
 
-    tempMin[i] = render_f2c(json_object_get_double(o_temperatureMin));
-    tempMax[i] = render_f2c(json_object_get_double(o_temperatureMax));
+    render_plot_label(pc, s, pc->daily.label_format?:"%d", p->time, offset);
+  }
 
-    time_t unixtime = json_object_get_int(o_time) + 86400;
-    struct tm *time = gmtime(&unixtime);
+  const PlotOverlay o = {
+    .n = 2,
+    .len = s->len,
+    .values = { tempMax, tempMin },
+    .colors = { PLOT_COLOR_BAR, PLOT_COLOR_BAR_OVERLAY },
+    .labels = s->plabels
+  };
 
-    strftime(labels[i], pc->bar.width+1, pc->daily.label_format?:"%d", time);
-    labels[i][pc->bar.width] = '\0';
-    plbl[i] = &labels[i][0];
-  }
+  const int ret = barplot_series(pc, &o);
+  plotseries_release(s);
 
-  barplot_overlaid(pc, tempMax, tempMin, plbl, 7);
+  return ret;
 }
 
-void render_daylight(const PlotCfg *pc, struct json_object *daily) {
-  EXTRACT_PREFIXED(daily, data);
-  struct array_list *al = json_object_get_array(daily_data);
-  int allen = array_list_length(al);
-  int times[3*allen];
+int render_daylight(const PlotCfg *pc, const Datablock *daily, double offset) {
+  int allen = daily->len < PLOT_SERIES_MAX ? daily->len : PLOT_SERIES_MAX;
+  time_t times[3*PLOT_SERIES_MAX];
   int j = 0;
 
   for(int i = 0; i < allen; i++) {
-    struct json_object *o  = array_list_get_idx(al, i);
-    EXTRACT_PREFIXED(o, time);
-    EXTRACT_PREFIXED(o, sunriseTime);
-    EXTRACT_PREFIXED(o, sunsetTime);
-    times[j++] = json_object_get_int(o_time);
-    times[j++] = json_object_get_int(o_sunriseTime);
-    times[j++] = json_object_get_int(o_sunsetTime);
+    const Datapoint *p = &daily->data[i];
+    times[j++] = p->time;
+    times[j++] = p->sunriseTime;
+    times[j++] = p->sunsetTime;
   }
 
-  barplot_daylight(pc, (const int*) &times[0], allen);
+  return barplot_daylight(pc, times, allen, offset);
 }
 
-int render_datapoint(struct json_object *o) {
-  assert(o);
-
-  EXTRACT_PREFIXED(o, time);
-  EXTRACT_PREFIXED(o, temperature);
-  EXTRACT_PREFIXED(o, apparentTemperature);
-  EXTRACT_PREFIXED(o, summary);
-  EXTRACT_PREFIXED(o, dewPoint);
-  EXTRACT_PREFIXED(o, humidity);
-  EXTRACT_PREFIXED(o, precipProbability);
-  EXTRACT_PREFIXED(o, cloudCover);
-  EXTRACT_PREFIXED(o, windSpeed);
-  EXTRACT_PREFIXED(o, pressure);
-  EXTRACT_PREFIXED(o, ozone);
-  EXTRACT_PREFIXED(o, windBearing); // FIXME: might be undefined
-
-  puts(   "-------------------------+");
-  printf( "   Time                  | %s"
+int render_datapoint(FILE *out, const Datapoint *p) {
+  assert(p);
+
+  char tbuf[RENDER_TIME_MAX];
+  char nbuf[9][RENDER_NUMBER_MAX];
+
+  /* Fields missing from the response are NAN; the whole numbers are
+   * truncated as before */
+  fputs(  "-------------------------+\n", out);
+  fprintf(out,
+          "   Time                  | %s"
           "   Condition             | %s\n"
-          "   Temperature           | %.*f °C\n"
-          "   Apparent temperature  | %.*f °C\n"
-          "   Dew point             | %.*f °C\n"
-          "   Precipitation         | %d %%\n"
-          "   RH (φ)                | %.*f %%\n"
-          "   Wind speed            | %d kph (%s)\n"
-          "   Cloud cover           | %d %%\n"
-          "   Pressure              | %.*f hPa\n"
-          "   Ozone                 | %.*f DU\n",
-              render_time(o_time),
-              json_object_get_string(o_summary),
-          1,  render_f2c(json_object_get_double(o_temperature)),
-          1,  render_f2c(json_object_get_double(o_apparentTemperature)),
-          1,  render_f2c(json_object_get_double(o_dewPoint)),
-              (int) (json_object_get_double(o_precipProbability) * 100.0),
-          1,  json_object_get_double(o_humidity) * 100,
-              (int) render_mph2kph(json_object_get_double(o_windSpeed)),
-              RENDER_BEARING(json_object_get_double(o_windBearing)),
-              (int) (json_object_get_double(o_cloudCover) * 100.0),
-          2,  json_object_get_double(o_pressure),
-          2,  json_object_get_double(o_ozone)
+          "   Temperature           | %s °C\n"
+          "   Apparent temperature  | %s °C\n"
+          "   Dew point             | %s °C\n"
+          "   Precipitation         | %s %%\n"
+          "   RH (φ)                | %s %%\n"
+          "   Wind speed            | %s kph (%s)\n"
+          "   Cloud cover           | %s %%\n"
+          "   Pressure              | %s hPa\n"
+          "   Ozone                 | %s DU\n",
+          render_time(p->time, tbuf),
+          p->summary ?: "",
+          render_number(nbuf[0], render_f2c(p->temperature), 1),
+          render_number(nbuf[1], render_f2c(p->apparentTemperature), 1),
+          render_number(nbuf[2], render_f2c(p->dewPoint), 1),
+          render_number(nbuf[3], trunc(p->precipProbability * 100.0), 0),
+          render_number(nbuf[4], p->humidity * 100, 1),
+          render_number(nbuf[5], trunc(render_mph2kph(p->windSpeed)), 0),
+          isnan(p->windBearing) ? "-" : RENDER_BEARING(p->windBearing),
+          render_number(nbuf[6], trunc(p->cloudCover * 100.0), 0),
+          render_number(nbuf[7], p->pressure, 2),
+          render_number(nbuf[8], p->ozone, 2)
         );
+
+  return 0;
+}
+
+void render_header(FILE *out, const Location *l, const Forecast *f) {
+  if(l->name != NULL)
+    fprintf(out, "Location                 | %s\n", l->name);
+  fprintf(out,
+          "Latitude                 | %.*f\n"
+          "Longitude                | %.*f\n"
+          "Timezone                 | %s\n"
+          "-------------------------+\n"
+          "Currently\n",
+          4,  f->latitude,
+          4,  f->longitude,
+              f->timezone);
 }
 
-int render(const Config *c, Data *d) {
-  struct json_object *o = json_tokener_parse(d->data);
-
-  EXTRACT_PREFIXED(o, timezone);
-  EXTRACT_PREFIXED(o, latitude);
-  EXTRACT_PREFIXED(o, longitude);
-  EXTRACT_PREFIXED(o, currently);
-  EXTRACT_PREFIXED(o, hourly);
-  EXTRACT_PREFIXED(o, daily);
-
-#define PRINT_HEADER                                \
-  printf( "Latitude                 | %.*f\n"       \
-          "Longitude                | %.*f\n"       \
-          "Timezone                 | %s\n"         \
-          "-------------------------+\n"            \
-          "Currently\n",                            \
-          4,  json_object_get_double(o_latitude),   \
-          4,  json_object_get_double(o_longitude),  \
-              json_object_get_string(o_timezone));
+int render(const Config *c, const Location *l, const Forecast *f, FILE *out) {
+  static const struct {
+    int op;
+    int block;
+    const char *name;
+  } needs[] = {
+    { OP_PRINT_CURRENTLY,             BLOCK_CURRENTLY, "currently" },
+    { OP_PRINT_HOURLY,                BLOCK_HOURLY,    "hourly"    },
+    { OP_PLOT_HOURLY,                 BLOCK_HOURLY,    "hourly"    },
+    { OP_PLOT_DAILY,                  BLOCK_DAILY,     "daily"     },
+    { OP_PLOT_PRECIPITATION_DAILY,    BLOCK_DAILY,     "daily"     },
+    { OP_PLOT_PRECIPITATION_HOURLY,   BLOCK_HOURLY,    "hourly"    },
+    { OP_PLOT_PRECIPITATION_MINUTELY, BLOCK_MINUTELY,  "minutely"  },
+    { OP_PLOT_DAYLIGHT,               BLOCK_DAILY,     "daily"     }
+  };
+
+  /* Data blocks may have been excluded from the request, so only the
+   * block the mode needs is required to be present */
+  for(int i = 0; i < sizeof(needs)/sizeof(needs[0]); i++)
+    if(needs[i].op == c->op && (f->blocks & needs[i].block) == 0) {
+      FERROR(0, "the %s data block is not available", needs[i].name);
+      return -1;
+    }
+
+  const uint64_t start = timings_now();
+  int ret = 0;
+
+  PROBE2(render__start, PROBE_LOCATION(l), c->op);
+
   switch(c->op) {
     case OP_PRINT_CURRENTLY:
-      PRINT_HEADER;
-      render_datapoint(o_currently);
+      render_header(out, l, f);
+      render_datapoint(out, &f->currently);
       break;
     case OP_PRINT_HOURLY:
-      PRINT_HEADER;
-      render_hourly_datapoints(o_hourly);
+      render_header(out, l, f);
+      render_hourly_datapoints(out, &f->hourly);
       break;
     case OP_PLOT_HOURLY:
-      render_hourly_datapoints_plot(&c->plot, o_hourly);
+      ret = render_hourly_datapoints_plot(&c->plot, &f->hourly, f->offset);
       break;
     case OP_PLOT_DAILY:
-      render_daily_temperature_plot(&c->plot, o_daily);
+      ret = render_daily_temperature_plot(&c->plot, &f->daily, f->offset);
       break;
     case OP_PLOT_PRECIPITATION_DAILY:
-      render_precipitation_plot_daily(&c->plot, o_daily);
+      ret = render_precipitation_plot_daily(&c->plot, &f->daily, f->offset);
       break;
     case OP_PLOT_PRECIPITATION_HOURLY:
-      render_precipitation_plot_hourly(&c->plot, o_hourly);
+      ret = render_precipitation_plot_hourly(&c->plot, &f->hourly, f->offset);
+      break;
+    case OP_PLOT_PRECIPITATION_MINUTELY:
+      ret = render_precipitation_plot_minutely(&c->plot, &f->minutely, f->offset);
       break;
     case OP_PLOT_DAYLIGHT:
-      render_daylight(&c->plot, o_daily);
+      ret = render_daylight(&c->plot, &f->daily, f->offset);
+      break;
+    case OP_DIFF:
+      FERROR(0, "diff mode compares two forecasts, see forecast_diff()");
+      return -1;
+    case OP_ALERT:
+      alert_evaluate(c, l, f, time(NULL), out);
       break;
   }
-#undef PRINT_HEADER
-
-  return 0;
-}
 
+  PROBE2(render__done, PROBE_LOCATION(l), c->op);
+  /* the plots wait for a key press */
+  if(OP_IS_TEXT(c->op))
+    metrics_observe(METRIC_RENDER_SECONDS, timings_now() - start);
 
+  return ret;
+}
@@ -20,8 +20,8 @@
 #define RENDER_H
 
 #include <assert.h>
-#include <json-c/json.h>
-#include <json-c/json_object.h>
+#include <math.h>
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
 
@@ -39,25 +39,25 @@
 
 #define NAME(prefix, name) PASTE(prefix, name)
 
-#define EXTRACT(object, key)  \
-  struct json_object *(key);  \
-  json_object_object_get_ex((object), #key, &(key));
+/* ctime_r(3) needs at least 26 bytes */
+#define RENDER_TIME_MAX 26
 
-#define EXTRACT_PREFIXED(object, key)                                                         \
-  struct json_object *(NAME(object, key)) = NULL;                                             \
-  if(json_object_object_get_ex((object), #key, &(NAME(object, key))) != TRUE)                 \
-    LERROR(EXIT_FAILURE, 0, "json_object_object_get_ex() failed: %s", #key);
+/* A number printed by render_datapoint() */
+#define RENDER_NUMBER_MAX 32
 
-char*   render_time(struct json_object*);
+char*   render_time(time_t t, char *buf);
 double  render_f2c(double fahrenheit);
+double  render_in2mm(double inches);
 double  render_mph2kph(double mph);
-int     render(const Config *c, Data *d);
-int     render_datapoint(struct json_object *d);
-void    render_hourly_datapoints(struct json_object*);
-void    render_hourly_datapoints_plot(const PlotCfg*, struct json_object*);
-void    render_daily_temperature_plot(const PlotCfg*, struct json_object*);
-void    render_precipitation_plot_daily(const PlotCfg *, struct json_object*);
-void    render_precipitation_plot_hourly(const PlotCfg *, struct json_object*);
-void    render_daylight(const PlotCfg*, struct json_object*);
+int     render(const Config *c, const Location *l, const Forecast *f, FILE *out);
+int     render_datapoint(FILE *out, const Datapoint *p);
+void    render_hourly_datapoints(FILE *out, const Datablock *hourly);
+int     render_hourly_datapoints_plot(const PlotCfg*, const Datablock *hourly, double offset);
+int     render_daily_temperature_plot(const PlotCfg*, const Datablock *daily, double offset);
+int     render_precipitation_plot_daily(const PlotCfg *, const Datablock *daily, double offset);
+int     render_precipitation_plot_hourly(const PlotCfg *, const Datablock *hourly, double offset);
+int     render_precipitation_plot_minutely(const PlotCfg *, const Datablock *minutely,
+          double offset);
+int     render_daylight(const PlotCfg*, const Datablock *daily, double offset);
 
 #endif
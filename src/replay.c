@@ -0,0 +1,279 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "replay.h"
+
+#define REPLAY_LINE_MAX 256
+
+typedef struct {
+  const char *key;
+  size_t keylen;
+  const char *body;
+  size_t bodylen;
+  int result;
+  long status;
+  double namelookup;
+  double connect;
+  double appconnect;
+  double starttransfer;
+  double total;
+  double size_download;
+  bool served;
+} ReplayRecord;
+
+/* The archive being replayed, loaded on first use */
+static struct {
+  pthread_mutex_t lock;
+  char *path;
+  char *map;
+  size_t maplen;
+  ReplayRecord *records;
+  int len;
+} archive = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .path = NULL,
+  .map = NULL,
+  .maplen = 0,
+  .records = NULL,
+  .len = 0
+};
+
+static int            replay_load(const char *path);
+static ReplayRecord*  replay_next(const char *key);
+
+/* One write per record under an exclusive lock, so that concurrent
+ * recorders don't interleave */
+int replay_record(const char *path, const char *key, int result, long status,
+    const char *headers, size_t headerslen, const Data *d) {
+  char line[REPLAY_LINE_MAX];
+  const size_t keylen = strlen(key);
+  const size_t bodylen = d->data ? d->datalen : 0;
+  int fd, linelen, ret = 0;
+  ssize_t len;
+
+  linelen = snprintf(line, sizeof(line),
+      REPLAY_MAGIC " %zu %zu %zu %d %ld %.6f %.6f %.6f %.6f %.6f %.0f\n",
+      keylen, headerslen, bodylen, result, status,
+      d->transfer.namelookup, d->transfer.connect, d->transfer.appconnect,
+      d->transfer.starttransfer, d->transfer.total, d->transfer.size_download);
+
+  const struct iovec iov[] = {
+    { line,                   linelen     },
+    { (void*) key,            keylen      },
+    { "\n",                   1           },
+    { (void*) headers,        headerslen  },
+    { d->data,                bodylen     },
+    { "\n",                   1           }
+  };
+  const size_t total = linelen + keylen + 1 + headerslen + bodylen + 1;
+
+  if((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644)) == -1) {
+    FERROR(errno, "%s", path);
+    return -1;
+  }
+
+  if(flock(fd, LOCK_EX) != 0
+      || (len = writev(fd, iov, sizeof(iov)/sizeof(iov[0]))) != total) {
+    FERROR(errno, "%s: failed to record the response", path);
+    ret = -1;
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+int replay_load(const char *path) {
+  struct stat st;
+  const char *p, *end;
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) != 0) {
+    FERROR(errno, "%s", path);
+    if(fd != -1)
+      close(fd);
+    return -1;
+  }
+
+  if(st.st_size > 0
+      && (archive.map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    FERROR(errno, "mmap(%s)", path);
+    archive.map = NULL;
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  archive.maplen = st.st_size;
+
+  if((archive.path = strdup(path)) == NULL) {
+    FERROR(errno, "strdup()");
+    return -1;
+  }
+
+  p = archive.map;
+  end = archive.map + archive.maplen;
+  while(p < end) {
+    ReplayRecord r = { .served = false };
+    char line[REPLAY_LINE_MAX];
+    const char *nl = memchr(p, '\n', end - p);
+    size_t headerslen;
+
+    if(nl == NULL || nl - p >= sizeof(line))
+      goto corrupt;
+    memcpy(line, p, nl - p);
+    line[nl - p] = '\0';
+
+    if(sscanf(line, REPLAY_MAGIC " %zu %zu %zu %d %ld %lf %lf %lf %lf %lf %lf",
+          &r.keylen, &headerslen, &r.bodylen, &r.result, &r.status,
+          &r.namelookup, &r.connect, &r.appconnect, &r.starttransfer,
+          &r.total, &r.size_download) != 11)
+      goto corrupt;
+
+    p = nl + 1;
+    if(end - p < r.keylen + 1 + headerslen + r.bodylen + 1)
+      goto corrupt;
+    r.key = p;
+    r.body = p + r.keylen + 1 + headerslen;
+    p = r.body + r.bodylen + 1;
+
+    if(archive.len % 64 == 0) {
+      ReplayRecord *records = realloc(archive.records, (archive.len + 64) * sizeof(ReplayRecord));
+      GUARD_ALLOC(records, -1);
+      archive.records = records;
+    }
+    archive.records[archive.len++] = r;
+  }
+
+  return 0;
+
+corrupt:
+  FERROR(0, "%s: corrupt record at offset %zu", path, (size_t) (p - archive.map));
+  return -1;
+}
+
+/* Records of a key are replayed in the order they were recorded, and
+ * from the start again once all of them have been */
+ReplayRecord* replay_next(const char *key) {
+  const size_t keylen = strlen(key);
+  ReplayRecord *first = NULL;
+
+  for(int i = 0; i < archive.len; i++) {
+    ReplayRecord *r = &archive.records[i];
+
+    if(r->keylen != keylen || memcmp(r->key, key, keylen) != 0)
+      continue;
+    if(r->served == false) {
+      r->served = true;
+      return r;
+    }
+    if(first == NULL)
+      first = r;
+  }
+
+  if(first != NULL) {
+    for(int i = 0; i < archive.len; i++)
+      if(archive.records[i].keylen == keylen
+          && memcmp(archive.records[i].key, key, keylen) == 0)
+        archive.records[i].served = false;
+    first->served = true;
+  }
+
+  return first;
+}
+
+int replay_fetch(const Config *c, const char *key, Data *d, long *status) {
+  ReplayRecord r;
+  ReplayRecord *next;
+
+  *status = -1;
+
+  pthread_mutex_lock(&archive.lock);
+  if(archive.path != NULL && strcmp(archive.path, c->replay_file) != 0)
+    replay_close();
+  if(archive.path == NULL && replay_load(c->replay_file) != 0) {
+    replay_close();
+    pthread_mutex_unlock(&archive.lock);
+    return -1;
+  }
+  next = replay_next(key);
+  if(next != NULL)
+    r = *next;
+  pthread_mutex_unlock(&archive.lock);
+
+  if(next == NULL) {
+    FERROR(0, "%s: no recorded response for %s", c->replay_file, key);
+    return -1;
+  }
+
+  if(c->replay_timing == true && r.total > 0.0)
+    nanosleep(&(struct timespec) {
+        .tv_sec = (time_t) r.total,
+        .tv_nsec = (long) ((r.total - (time_t) r.total) * 1e9) }, NULL);
+
+  d->transfer.namelookup = r.namelookup;
+  d->transfer.connect = r.connect;
+  d->transfer.appconnect = r.appconnect;
+  d->transfer.starttransfer = r.starttransfer;
+  d->transfer.total = r.total;
+  d->transfer.size_download = r.size_download;
+  *status = r.status;
+
+  if(r.result != CURLE_OK) {
+    if(r.result == CURLE_HTTP_RETURNED_ERROR)
+      FERROR(0, "HTTP status %ld (replayed)", r.status);
+    else
+      FERROR(0, "cURL error %d (replayed)", r.result);
+    return -1;
+  }
+
+  d->data = malloc(r.bodylen + 1);
+  GUARD_ALLOC(d->data, -1);
+  memcpy(d->data, r.body, r.bodylen);
+  d->data[r.bodylen] = '\0';
+  d->datalen = r.bodylen;
+  d->codec = CODEC_NONE;
+
+  return 0;
+}
+
+/* Called with archive.lock held or from forecast_cleanup() */
+void replay_close(void) {
+  if(archive.map != NULL)
+    munmap(archive.map, archive.maplen);
+  free(archive.records);
+  free(archive.path);
+  archive.map = NULL;
+  archive.maplen = 0;
+  archive.records = NULL;
+  archive.len = 0;
+  archive.path = NULL;
+}
@@ -0,0 +1,44 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stddef.h>
+
+#include "forecast.h"
+
+/* A replay archive is an append-only file of API responses. Every
+ * record starts with a line
+ *
+ *   FRR1 KEYLEN HEADERSLEN BODYLEN RESULT STATUS NAMELOOKUP CONNECT
+ *        APPCONNECT STARTTRANSFER TOTAL SIZE_DOWNLOAD
+ *
+ * followed by the key, a newline, the response headers, the body and a
+ * newline. RESULT is the CURLcode of the transfer. The key is the
+ * request URL without the base URL and the API key, so archives can be
+ * shared. */
+#define REPLAY_MAGIC "FRR1"
+
+int   replay_record(const char *path, const char *key, int result, long status,
+        const char *headers, size_t headerslen, const Data *d);
+/* status is the recorded HTTP status, or -1 if nothing could be replayed */
+int   replay_fetch(const Config *c, const char *key, Data *d, long *status);
+void  replay_close(void);
+
+#endif
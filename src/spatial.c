@@ -0,0 +1,244 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cache.h"
+#include "cacheindex.h"
+#include "codec.h"
+#include "metrics.h"
+#include "probes.h"
+#include "spatial.h"
+
+#define EARTH_RADIUS 6371.0
+#define KM_PER_DEGREE (M_PI * EARTH_RADIUS / 180.0)
+
+typedef struct {
+  const Location *l;
+  double tolerance;
+  int index_age;          /* max_cache_age of the indexed entries */
+  time_t now;
+  double distance;
+  const char *path;       /* of a configured location's cache file, or */
+  CacheIndexSlot slot;    /* the closest indexed entry if path is NULL */
+} Candidate;
+
+static double   haversine(double la1, double lo1, double la2, double lo2);
+static uint64_t cell_bucket(long la, long lo);
+static long     cell_wrap(long lo);
+static int      index_base(const Config *c, char *base, size_t len);
+static bool     closer(Candidate *best, double la, double lo, time_t fetched, int max_age);
+static bool     same_blocks(const Location *a, const Location *b);
+static void     consider_slot(const CacheIndexSlot *s, void *arg);
+static void     evict_slot(const Config *c, const CacheIndexSlot *s);
+
+/* Great circle distance in km */
+double haversine(double la1, double lo1, double la2, double lo2) {
+  const double r = M_PI / 180.0;
+  const double dla = (la2 - la1) * r;
+  const double dlo = (lo2 - lo1) * r;
+  const double a = sin(dla / 2) * sin(dla / 2)
+    + cos(la1 * r) * cos(la2 * r) * sin(dlo / 2) * sin(dlo / 2);
+
+  return 2 * EARTH_RADIUS * asin(sqrt(a));
+}
+
+uint64_t cell_bucket(long la, long lo) {
+  return (uint64_t)(uint32_t) la << 32 | (uint32_t) lo;
+}
+
+/* Longitude cell in [-SPATIAL_CELLS/2, SPATIAL_CELLS/2) */
+long cell_wrap(long lo) {
+  return ((lo + SPATIAL_CELLS/2) % SPATIAL_CELLS + SPATIAL_CELLS) % SPATIAL_CELLS
+    - SPATIAL_CELLS/2;
+}
+
+int index_base(const Config *c, char *base, size_t len) {
+  if(snprintf(base, len, "%s.spatial", c->cache_file) >= len) {
+    FERROR(0, "cache path too long");
+    return -1;
+  }
+  return 0;
+}
+
+/* Whether a point fetched at the given time is still fresh by its own
+ * max_age and closer than anything before, in which case it becomes the
+ * best distance */
+bool closer(Candidate *best, double la, double lo, time_t fetched, int max_age) {
+  const double distance = haversine(best->l->latitude, best->l->longitude, la, lo);
+
+  if(distance > best->tolerance || distance >= best->distance
+      || best->now - fetched >= max_age)
+    return false;
+  best->distance = distance;
+  return true;
+}
+
+void consider_slot(const CacheIndexSlot *s, void *arg) {
+  Candidate *best = (Candidate*) arg;
+
+  if(closer(best, s->latitude, s->longitude, s->fetched, best->index_age)) {
+    best->path = NULL;
+    best->slot = *s;
+  }
+}
+
+/* Whether the cached forecasts of a and b contain the same data blocks */
+bool same_blocks(const Location *a, const Location *b) {
+  if(a->exclude == NULL || b->exclude == NULL)
+    return a->exclude == b->exclude;
+  return strcmp(a->exclude, b->exclude) == 0;
+}
+
+/* Drops an indexed entry that can't be served, so that lookups stop
+ * finding it. Failing to is harmless; compaction gets to it later. */
+void evict_slot(const Config *c, const CacheIndexSlot *s) {
+  char base[PATH_MAX];
+  CacheIndex ci;
+
+  if(index_base(c, base, sizeof(base)) == 0 && cacheindex_open(base, true, &ci) == 0) {
+    cacheindex_delete(&ci, s);
+    cacheindex_close(&ci);
+  }
+}
+
+int spatial_load(const Config *c, const Location *l, Data *d) {
+  const double dla = c->cache_tolerance / KM_PER_DEGREE;
+  /* Near the poles, every longitude is within reach */
+  const double coslat = cos(fmin(fabs(l->latitude) + dla, 90.0) * M_PI / 180.0);
+  const double dlo = coslat > 1e-6 ? fmin(dla / coslat, 180.0) : 180.0;
+  Candidate best = {
+    .l = l,
+    .tolerance = c->cache_tolerance,
+    .index_age = c->max_cache_age,
+    .now = time(NULL),
+    .distance = INFINITY,
+    .path = NULL
+  };
+  char base[PATH_MAX];
+  CacheIndex ci;
+  bool evict = false;
+  int ret = -1;
+
+  /* A location restricted to some blocks can't stand in for one that
+   * wants others */
+  for(int i = 0; i < c->locations_len; i++) {
+    const Location *cl = &c->locations[i];
+    struct stat s;
+
+    if(cl->cache_file != NULL && same_blocks(cl, l) && stat(cl->cache_file, &s) == 0
+        && closer(&best, cl->latitude, cl->longitude, s.st_mtime, cl->max_cache_age))
+      best.path = cl->cache_file;
+  }
+
+  /* No index yet simply means nothing was cached. Only forecasts of
+   * all blocks are indexed. */
+  if(l->exclude == NULL && index_base(c, base, sizeof(base)) == 0
+      && cacheindex_open(base, false, &ci) == 0) {
+    const long lo_first = floor((l->longitude - dlo) / SPATIAL_CELL);
+    const long lo_last = floor((l->longitude + dlo) / SPATIAL_CELL);
+
+    for(long la = floor((l->latitude - dla) / SPATIAL_CELL);
+        la <= floor((l->latitude + dla) / SPATIAL_CELL); la++)
+      /* Across the antimeridian, the cells continue at -180° */
+      for(long lo = lo_first; lo <= lo_last && lo < lo_first + SPATIAL_CELLS; lo++)
+        cacheindex_scan(&ci, cell_bucket(la, cell_wrap(lo)), consider_slot, &best);
+
+    if(isinf(best.distance) == 0 && best.path == NULL
+        && ((ret = cacheindex_read(&ci, &best.slot, d)) != 0
+          || (ret = codec_unpack(d)) != 0)) {
+      free(d->data);
+      *d = (Data) DATA_NULL;
+      evict = true;
+    }
+    cacheindex_close(&ci);
+  }
+
+  if(best.path != NULL) {
+    Location hit = *l;
+    hit.cache_file = (char*) best.path;
+    ret = load_cache_stale(&hit, d);
+  }
+
+  /* The closest point's data being out of date, the others' is too */
+  if(ret == 0 && cache_outdated(l, d, best.now) != 0) {
+    free(d->data);
+    *d = (Data) DATA_NULL;
+    evict = best.path == NULL;
+    ret = -1;
+  }
+
+  /* The index is only locked for writing once it is known to be needed */
+  if(evict)
+    evict_slot(c, &best.slot);
+
+  if(ret != 0) {
+    PROBE1(cache__miss, PROBE_LOCATION(l));
+    metrics_count(METRIC_CACHE_MISSES, 1);
+    return -1;
+  }
+
+  PROBE2(cache__hit, PROBE_LOCATION(l), d->datalen);
+  metrics_count(METRIC_CACHE_HITS, 1);
+
+  return 0;
+}
+
+int spatial_save(const Config *c, const Location *l, const Data *d) {
+  const time_t now = time(NULL);
+  char base[PATH_MAX], key[CACHEINDEX_KEY_MAX];
+  Data packed = DATA_NULL;
+  CacheIndex ci;
+  int ret;
+
+  /* The index doesn't record which blocks an entry has */
+  if(l->exclude != NULL)
+    return 0;
+
+  if(c->cache_compress == true && codec_pack(d, &packed) == 0)
+    d = &packed;
+
+  if(index_base(c, base, sizeof(base)) != 0 || cacheindex_open(base, true, &ci) != 0) {
+    free(packed.data);
+    return -1;
+  }
+
+  /* Entries too old to be served are dropped along the way */
+  if(cacheindex_needs_compaction(&ci) && cacheindex_compact(&ci, now - c->max_cache_age) != 0) {
+    cacheindex_close(&ci);
+    free(packed.data);
+    return -1;
+  }
+
+  snprintf(key, sizeof(key), "%.5f,%.5f", l->latitude, l->longitude);
+  ret = cacheindex_put(&ci, cell_bucket(floor(l->latitude / SPATIAL_CELL),
+        cell_wrap(floor(l->longitude / SPATIAL_CELL))), key, l->latitude, l->longitude, now, d);
+
+  cacheindex_close(&ci);
+  free(packed.data);
+
+  return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include "forecast.h"
+
+/* Cache for ad-hoc locations (those without a cache file of their own):
+ * forecasts are kept in the cache index <cache_file>.spatial, bucketed
+ * by grid cells of SPATIAL_CELL degrees, so a lookup only has to look at
+ * the cells within cache_tolerance kilometres. Named locations within
+ * the tolerance are candidates as well if they cache the same data
+ * blocks. */
+
+#define SPATIAL_CELL 0.1
+#define SPATIAL_CELLS 3600      /* around a circle of latitude */
+
+int spatial_load(const Config *c, const Location *l, Data *d);
+int spatial_save(const Config *c, const Location *l, const Data *d);
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "timings.h"
+
+uint64_t timings_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Records the time elapsed since `since`, a timings_now() value */
+void timings_record(Timings *t, const char *phase, uint64_t since) {
+  timings_value(t, phase, (timings_now() - since) / 1e6, "ms");
+}
+
+void timings_value(Timings *t, const char *phase, double value, const char *unit) {
+  if(t == NULL || t->len == TIMINGS_MAX)
+    return;
+
+  t->entries[t->len].phase = phase;
+  t->entries[t->len].value = value;
+  t->entries[t->len].unit = unit;
+  t->len++;
+}
+
+void timings_print(const Timings *t, const char *prefix, FILE *out) {
+  if(t == NULL)
+    return;
+
+  for(int i = 0; i < t->len; i++) {
+    char name[64];
+
+    snprintf(name, sizeof(name), "%s%s%s", prefix ?: "", prefix ? " " : "",
+        t->entries[i].phase);
+    fprintf(out, "timings: %-32s %12.*f %s\n", name,
+        strcmp(t->entries[i].unit, "bytes") == 0 ? 0 : 3,
+        t->entries[i].value, t->entries[i].unit);
+  }
+}
@@ -0,0 +1,46 @@
+/*
+ *  forecast - query weather forecasts from forecast.io
+ *  Copyright (C) 2015 Jens John <dev@2ion.de>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMINGS_H
+#define TIMINGS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define TIMINGS_MAX 24
+
+typedef struct {
+  int len;
+  struct {
+    const char *phase;
+    double value;
+    const char *unit;
+  } entries[TIMINGS_MAX];
+} Timings;
+
+#define TIMINGS_NULL { .len = 0 }
+
+/* All functions accept t == NULL and then do nothing, so callers can
+ * pass their Timings along unconditionally */
+uint64_t  timings_now(void);
+void      timings_record(Timings *t, const char *phase, uint64_t since);
+void      timings_value(Timings *t, const char *phase, double value, const char *unit);
+void      timings_print(const Timings *t, const char *prefix, FILE *out);
+
+#endif